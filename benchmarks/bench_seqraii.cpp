@@ -0,0 +1,353 @@
+/**
+ * Overhead of SequentialRaii compared to hand-written goto-cleanup code.
+ * Every step increments or decrements a counter, so what is measured is the cost of the
+ * abstraction itself.
+ */
+
+#include "../seqraii.h"
+#include <benchmark/benchmark.h>
+#include <new>
+#include <utility>
+#include <vector>
+
+using namespace sequentialraii;
+
+namespace
+{
+/// Step work shared by all variants.
+inline bool initItem(long& counter) noexcept
+{
+    ++counter;
+    benchmark::ClobberMemory();
+    return true;
+}
+
+inline void uninitItem(long& counter) noexcept
+{
+    --counter;
+    benchmark::ClobberMemory();
+}
+
+/**
+ * Builds a sequence of count steps. When failAt is below count that step fails.
+ */
+void buildSequence(SequentialRaii& seqraii, long& counter, long count, long failAt = -1)
+{
+    for (long i = 0; i < count; ++i)
+    {
+        if (i == failAt)
+        {
+            seqraii.addStep([]() {return false;});
+        }
+        else
+        {
+            seqraii.addStep([&counter]() {return initItem(counter);}, [&counter]() {uninitItem(counter);});
+        }
+    }
+}
+
+/**
+ * Hand-written equivalent of a sequence: initialize items in order, on failure jump to the
+ * cleanup of the items initialized so far.
+ */
+bool baselineInitialize(long& counter, long count, long failAt, long& initialized) noexcept
+{
+    for (initialized = 0; initialized < count; ++initialized)
+    {
+        if (initialized == failAt || !initItem(counter))
+        {
+            goto cleanup;
+        }
+    }
+
+    return true;
+
+cleanup:
+    while (initialized > 0)
+    {
+        uninitItem(counter);
+        --initialized;
+    }
+
+    return false;
+}
+
+void baselineUninitialize(long& counter, long& initialized) noexcept
+{
+    while (initialized > 0)
+    {
+        uninitItem(counter);
+        --initialized;
+    }
+}
+
+/**
+ * Hand-written equivalent of the container: a table of the steps, one entry per step holding the
+ * functions and the state they work on.
+ */
+struct BaselineStep
+{
+    bool (*init)(long&) noexcept;
+    void (*uninit)(long&) noexcept;
+    long* counter;
+};
+
+void baselineBuild(std::vector<BaselineStep>& steps, long& counter, long count)
+{
+    for (long i = 0; i < count; ++i)
+    {
+        steps.push_back(BaselineStep{&initItem, &uninitItem, &counter});
+    }
+}
+
+/**
+ * Moves an object back and forth between two slots by move construction, destroying the source
+ * each time, so that every iteration moves once.
+ */
+template <class T>
+class MoveSlots
+{
+public:
+    explicit MoveSlots(T&& initial)
+    {
+        new (m_storage[0]) T(std::move(initial));
+    }
+
+    ~MoveSlots()
+    {
+        slot(m_current).~T();
+    }
+
+    void moveConstruct()
+    {
+        T& from = slot(m_current);
+        m_current ^= 1;
+        new (m_storage[m_current]) T(std::move(from));
+        from.~T();
+    }
+
+    T& current() noexcept
+    {
+        return slot(m_current);
+    }
+
+private:
+    T& slot(unsigned index) noexcept
+    {
+        return *reinterpret_cast<T*>(m_storage[index]);
+    }
+
+    alignas(T) unsigned char m_storage[2][sizeof(T)];
+    unsigned m_current = 0;
+};
+
+template <std::size_t I>
+auto staticStep(long& counter)
+{
+    return step([&counter]() {return initItem(counter);}, [&counter]() {uninitItem(counter);});
+}
+
+template <std::size_t... I>
+auto makeStaticSequence(long& counter, std::index_sequence<I...>)
+{
+    return makeSequence(staticStep<I>(counter)...);
+}
+
+} // Namespace
+
+static void BM_Build(benchmark::State& state)
+{
+    long counter = 0;
+    for (auto _ : state)
+    {
+        SequentialRaii seqraii;
+        buildSequence(seqraii, counter, state.range(0));
+        benchmark::DoNotOptimize(seqraii);
+    }
+}
+
+static void BM_BaselineBuild(benchmark::State& state)
+{
+    long counter = 0;
+    for (auto _ : state)
+    {
+        std::vector<BaselineStep> steps;
+        baselineBuild(steps, counter, state.range(0));
+        benchmark::DoNotOptimize(steps.data());
+    }
+}
+
+static void BM_BuildReserved(benchmark::State& state)
+{
+    long counter = 0;
+    for (auto _ : state)
+    {
+        SequentialRaii seqraii;
+        seqraii.reserve(state.range(0));
+        buildSequence(seqraii, counter, state.range(0));
+        benchmark::DoNotOptimize(seqraii);
+    }
+}
+
+static void BM_InitializeUninitialize(benchmark::State& state)
+{
+    long counter = 0;
+    SequentialRaii seqraii;
+    buildSequence(seqraii, counter, state.range(0));
+
+    for (auto _ : state)
+    {
+        seqraii.initialize();
+        seqraii.uninitialize();
+    }
+}
+
+static void BM_BuildRange(benchmark::State& state)
+{
+    long counter = 0;
+    for (auto _ : state)
+    {
+        SequentialRaii seqraii;
+        seqraii.addSteps(state.range(0), [&counter](std::size_t) {return initItem(counter);},
+                         [&counter](std::size_t) {uninitItem(counter);});
+        benchmark::DoNotOptimize(seqraii);
+    }
+}
+
+static void BM_RangeInitializeUninitialize(benchmark::State& state)
+{
+    long counter = 0;
+    SequentialRaii seqraii;
+    seqraii.addSteps(state.range(0), [&counter](std::size_t) {return initItem(counter);},
+                     [&counter](std::size_t) {uninitItem(counter);});
+
+    for (auto _ : state)
+    {
+        seqraii.initialize();
+        seqraii.uninitialize();
+    }
+}
+
+static void BM_BaselineInitializeUninitialize(benchmark::State& state)
+{
+    long counter = 0;
+    long initialized = 0;
+    for (auto _ : state)
+    {
+        baselineInitialize(counter, state.range(0), -1, initialized);
+        baselineUninitialize(counter, initialized);
+    }
+}
+
+template <std::size_t N>
+static void BM_StaticInitializeUninitialize(benchmark::State& state)
+{
+    long counter = 0;
+    auto seqraii = makeStaticSequence(counter, std::make_index_sequence<N>{});
+
+    for (auto _ : state)
+    {
+        seqraii.initialize();
+        seqraii.uninitialize();
+    }
+}
+
+static void BM_FailedInitialize(benchmark::State& state)
+{
+    // The last step fails, so all steps before it are rolled back.
+    long counter = 0;
+    SequentialRaii seqraii;
+    buildSequence(seqraii, counter, state.range(0), state.range(0) - 1);
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(seqraii.initialize());
+    }
+}
+
+static void BM_BaselineFailedInitialize(benchmark::State& state)
+{
+    long counter = 0;
+    long initialized = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(baselineInitialize(counter, state.range(0), state.range(0) - 1, initialized));
+    }
+}
+
+static void BM_MoveConstruct(benchmark::State& state)
+{
+    long counter = 0;
+    SequentialRaii seqraii;
+    buildSequence(seqraii, counter, state.range(0));
+    MoveSlots<SequentialRaii> slots(std::move(seqraii));
+
+    for (auto _ : state)
+    {
+        slots.moveConstruct();
+        benchmark::DoNotOptimize(slots.current());
+    }
+}
+
+static void BM_BaselineMoveConstruct(benchmark::State& state)
+{
+    long counter = 0;
+    std::vector<BaselineStep> steps;
+    baselineBuild(steps, counter, state.range(0));
+    MoveSlots<std::vector<BaselineStep>> slots(std::move(steps));
+
+    for (auto _ : state)
+    {
+        slots.moveConstruct();
+        benchmark::DoNotOptimize(slots.current());
+    }
+}
+
+static void BM_MoveAssign(benchmark::State& state)
+{
+    long counter = 0;
+    SequentialRaii slots[2];
+    buildSequence(slots[0], counter, state.range(0));
+    unsigned current = 0;
+
+    for (auto _ : state)
+    {
+        slots[current ^ 1] = std::move(slots[current]);
+        current ^= 1;
+        benchmark::DoNotOptimize(slots[current]);
+    }
+}
+
+static void BM_BaselineMoveAssign(benchmark::State& state)
+{
+    long counter = 0;
+    std::vector<BaselineStep> slots[2];
+    baselineBuild(slots[0], counter, state.range(0));
+    unsigned current = 0;
+
+    for (auto _ : state)
+    {
+        slots[current ^ 1] = std::move(slots[current]);
+        current ^= 1;
+        benchmark::DoNotOptimize(slots[current]);
+    }
+}
+
+BENCHMARK(BM_Build)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_BaselineBuild)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_BuildReserved)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_InitializeUninitialize)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_BaselineInitializeUninitialize)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_BuildRange)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_RangeInitializeUninitialize)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK_TEMPLATE(BM_StaticInitializeUninitialize, 1);
+BENCHMARK_TEMPLATE(BM_StaticInitializeUninitialize, 10);
+BENCHMARK_TEMPLATE(BM_StaticInitializeUninitialize, 100);
+BENCHMARK(BM_FailedInitialize)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_BaselineFailedInitialize)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_MoveConstruct)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_BaselineMoveConstruct)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_MoveAssign)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+BENCHMARK(BM_BaselineMoveAssign)->Arg(1)->Arg(10)->Arg(100)->Arg(10000);
+
+BENCHMARK_MAIN();
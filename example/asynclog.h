@@ -0,0 +1,243 @@
+/**
+ * Asynchronous logging for the UDP echo server example. Workers push fixed-size binary records
+ * into their own single-producer single-consumer ring without blocking or formatting, and a
+ * background thread formats and writes them in batches.
+ */
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * What is logged about a datagram.
+ */
+struct LogRecord
+{
+    std::uint32_t addr;         // Client address, network byte order.
+    std::uint16_t port;         // Client port, network byte order.
+    std::uint32_t length;       // Payload length.
+    std::int64_t timestamp;     // Steady clock nanoseconds.
+};
+
+/**
+ * Bounded ring with one producer and one consumer. The producer never blocks: it counts the
+ * records it had to drop when the ring was full.
+ */
+class LogRing
+{
+public:
+    /// Number of records the ring holds, a power of two.
+    static constexpr std::size_t CAPACITY = 4096;
+
+    /**
+     * Called by the producer only.
+     */
+    void push(const LogRecord& record)
+    {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead == CAPACITY)
+        {
+            // Only look at the consumer's position when the ring seems full.
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead == CAPACITY)
+            {
+                m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        m_records[tail & (CAPACITY - 1)] = record;
+        m_tail.store(tail + 1, std::memory_order_release);
+    }
+
+    /**
+     * Called by the consumer only, hands every queued record to the function.
+     */
+    template <class Function>
+    void drain(Function&& function)
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        const std::size_t tail = m_tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head)
+        {
+            function(m_records[head & (CAPACITY - 1)]);
+        }
+
+        m_head.store(head, std::memory_order_release);
+    }
+
+    std::uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    LogRecord m_records[CAPACITY];
+
+    // Producer and consumer positions kept a cache line apart. Padded rather than aligned, since
+    // C++14 has no over-aligned new.
+    std::atomic<std::size_t> m_tail{0};
+    std::size_t m_cachedHead = 0;
+    std::atomic<std::uint64_t> m_dropped{0};
+    char m_padding[64];
+    std::atomic<std::size_t> m_head{0};
+};
+
+/**
+ * Background writer draining the rings of all producers. start() and stop(), and open() and
+ * close() for every producer, are meant to be run as steps.
+ */
+class AsyncLog
+{
+public:
+    /// How long the writer sleeps between batches.
+    static constexpr std::chrono::milliseconds INTERVAL{10};
+
+    /**
+     * Starts the writer thread.
+     */
+    bool start()
+    {
+        m_start = std::chrono::steady_clock::now();
+        m_stopping.store(false, std::memory_order_relaxed);
+        m_writer = std::thread([this]() {run();});
+        return true;
+    }
+
+    /**
+     * Writes what is left, reports the dropped records and joins the writer.
+     */
+    void stop()
+    {
+        m_stopping.store(true, std::memory_order_release);
+        m_writer.join();
+
+        std::uint64_t dropped = m_dropped;
+        for (const auto& ring : m_rings)
+        {
+            dropped += ring->dropped();
+        }
+
+        if (dropped > 0)
+        {
+            std::fprintf(stderr, "%llu log records dropped\n", static_cast<unsigned long long>(dropped));
+        }
+    }
+
+    /**
+     * Creates the ring of a new producer.
+     */
+    LogRing* open()
+    {
+        std::unique_ptr<LogRing> ring(new LogRing());
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_rings.push_back(std::move(ring));
+        return m_rings.back().get();
+    }
+
+    /**
+     * Writes out and removes the ring of a producer that has finished.
+     */
+    void close(LogRing* ring)
+    {
+        std::string text;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_rings.begin(); it != m_rings.end(); ++it)
+        {
+            if (it->get() == ring)
+            {
+                format(*ring, text);
+                write(text);
+                m_dropped += ring->dropped();
+                m_rings.erase(it);
+                return;
+            }
+        }
+    }
+
+private:
+    void run()
+    {
+        std::string text;
+        while (!m_stopping.load(std::memory_order_acquire))
+        {
+            drainAll(text);
+            std::this_thread::sleep_for(INTERVAL);
+        }
+
+        drainAll(text);
+    }
+
+    void drainAll(std::string& text)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& ring : m_rings)
+        {
+            format(*ring, text);
+        }
+
+        write(text);
+    }
+
+    void format(LogRing& ring, std::string& text)
+    {
+        const std::int64_t start = std::chrono::duration_cast<std::chrono::nanoseconds>(m_start.time_since_epoch()).count();
+        ring.drain(
+            [&](const LogRecord& record)
+            {
+                char address[INET_ADDRSTRLEN];
+                in_addr addr = {};
+                addr.s_addr = record.addr;
+                inet_ntop(AF_INET, &addr, address, sizeof(address));
+
+                char line[128];
+                const std::int64_t elapsed = record.timestamp - start;
+                const int length = std::snprintf(line, sizeof(line), "%lld.%06lld %s:%u -> %u bytes\n",
+                    static_cast<long long>(elapsed / 1000000000), static_cast<long long>(elapsed % 1000000000 / 1000),
+                    address, ntohs(record.port), record.length);
+                text.append(line, length);
+            });
+    }
+
+    /**
+     * Writes a batch of formatted records with as few system calls as possible.
+     */
+    static void write(std::string& text)
+    {
+        std::size_t written = 0;
+        while (written < text.size())
+        {
+            const ssize_t result = ::write(STDOUT_FILENO, text.data() + written, text.size() - written);
+            if (result <= 0)
+            {
+                break;
+            }
+
+            written += static_cast<std::size_t>(result);
+        }
+
+        text.clear();
+    }
+
+    std::chrono::steady_clock::time_point m_start;
+    std::atomic<bool> m_stopping{false};
+    std::thread m_writer;
+
+    /// Rings of the producers, and the records dropped by those gone, guarded by m_mutex.
+    std::vector<std::unique_ptr<LogRing>> m_rings;
+    std::uint64_t m_dropped = 0;
+    std::mutex m_mutex;
+};
+
+constexpr std::size_t LogRing::CAPACITY;
+constexpr std::chrono::milliseconds AsyncLog::INTERVAL;
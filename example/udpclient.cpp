@@ -0,0 +1,516 @@
+/**
+ * Load generator for the UDP echo server. Sends numbered, timestamped datagrams at a target rate
+ * and matches the echoes by sequence number.
+ *
+ * Usage: udpclient [--host A.B.C.D] [--size BYTES] [--rate PPS] [--threads T] [--batch K]
+ *                  [--duration SECONDS] [--quit]
+ * Every thread has its own connected socket and sends batches of K datagrams with one sendmmsg(),
+ * paced so that all threads together send PPS datagrams per second (0 sends as fast as possible).
+ * Echoes are collected with recvmmsg() in between. At the end the send and echo rates, the echoed
+ * throughput, the share of datagrams that never came back and the round-trip time percentiles are
+ * printed. --quit sends the server the 'x' that terminates it afterwards.
+ * All sockets, buffers and sending threads are brought up and torn down as SequentialRaii steps.
+ */
+
+#include "../seqraii.h"
+#include "../seqraii_blueprint.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sequentialraii;
+
+// Server UDP port.
+constexpr unsigned short PORT = 1234;
+
+// Biggest datagram the server echoes in one piece.
+constexpr unsigned MAX_DATAGRAM_SIZE = 1024;
+
+// How long echoes are still waited for once sending has stopped.
+constexpr std::chrono::milliseconds DRAIN_TIME{500};
+
+// Socket buffer size asked for, so that bursts are not dropped by the client itself.
+constexpr int SOCKET_BUFFER_SIZE = 4 << 20;
+
+/**
+ * What every datagram starts with, the rest is padding.
+ */
+struct Header
+{
+    std::uint64_t sequence;
+    std::int64_t sent;          // Steady clock nanoseconds.
+};
+
+std::int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Histogram of round-trip times in the style of HdrHistogram: every power of two is split into
+ * SUB_BUCKETS buckets of equal width, so that every value is recorded with about 3% precision
+ * whatever its magnitude, in constant space.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 5;
+    static constexpr unsigned SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+
+    LatencyHistogram()
+        : m_counts((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS, 0)
+    {}
+
+    void record(std::int64_t nanoseconds)
+    {
+        ++m_counts[index(nanoseconds > 0 ? static_cast<std::uint64_t>(nanoseconds) : 0)];
+        ++m_total;
+    }
+
+    void merge(const LatencyHistogram& other)
+    {
+        for (std::size_t i = 0; i < m_counts.size(); ++i)
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+
+        m_total += other.m_total;
+    }
+
+    std::uint64_t total() const
+    {
+        return m_total;
+    }
+
+    /**
+     * @return Lowest value of the bucket holding the given percentile, in nanoseconds.
+     */
+    std::uint64_t percentile(double percent) const
+    {
+        const std::uint64_t rank = static_cast<std::uint64_t>(percent / 100.0 * m_total + 0.5);
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < m_counts.size(); ++i)
+        {
+            seen += m_counts[i];
+            if (seen >= rank && seen > 0)
+            {
+                return lowest(i);
+            }
+        }
+
+        return 0;
+    }
+
+private:
+    /**
+     * Values below 2 * SUB_BUCKETS have a bucket each. Above, the highest SUB_BUCKET_BITS + 1 bits
+     * select the bucket, and the number of bits dropped the power of two.
+     */
+    static std::size_t index(std::uint64_t value)
+    {
+        if (value < 2 * SUB_BUCKETS)
+        {
+            return static_cast<std::size_t>(value);
+        }
+
+        const unsigned shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<std::size_t>((value >> shift) - SUB_BUCKETS);
+    }
+
+    static std::uint64_t lowest(std::size_t index)
+    {
+        if (index < 2 * SUB_BUCKETS)
+        {
+            return index;
+        }
+
+        const unsigned shift = static_cast<unsigned>(index / SUB_BUCKETS) - 1;
+        return static_cast<std::uint64_t>(index % SUB_BUCKETS + SUB_BUCKETS) << shift;
+    }
+
+    std::vector<std::uint64_t> m_counts;
+    std::uint64_t m_total = 0;
+};
+
+/**
+ * Command line settings.
+ */
+struct Settings
+{
+    in_addr host = {htonl(INADDR_LOOPBACK)};
+    unsigned size = 64;
+    double rate = 0;
+    unsigned threads = 1;
+    unsigned batch = 16;
+    double duration = 5;
+    bool quit = false;
+};
+
+/**
+ * One sending thread, with its own socket and statistics.
+ */
+struct Sender
+{
+    Sender(unsigned index_, const Settings& settings_)
+        : index(index_)
+        , settings(settings_)
+    {}
+
+    unsigned index;
+    Settings settings;
+    int socketfd = -1;
+
+    // Send and receive batches, preallocated by a step.
+    std::vector<char> sendBuffers;
+    std::vector<char> receiveBuffers;
+    std::vector<iovec> iovecs;
+    std::vector<mmsghdr> messages;
+
+    // Which sequence numbers came back, to tell echoes from duplicates.
+    std::vector<bool> echoed;
+
+    std::uint64_t sent = 0;
+    std::uint64_t received = 0;
+    std::uint64_t receivedBytes = 0;
+    LatencyHistogram rtt;
+    std::thread thread;
+    std::atomic<bool> stop{false};
+};
+
+/**
+ * Takes every echo already queued on the socket, without blocking.
+ */
+void collect(Sender& sender)
+{
+    const unsigned batch = sender.settings.batch;
+    mmsghdr* messages = sender.messages.data() + batch;
+    while (true)
+    {
+        for (unsigned i = 0; i < batch; ++i)
+        {
+            sender.iovecs[batch + i].iov_len = MAX_DATAGRAM_SIZE;
+        }
+
+        const int count = recvmmsg(sender.socketfd, messages, batch, MSG_DONTWAIT, nullptr);
+        if (count <= 0)
+        {
+            return;
+        }
+
+        const std::int64_t arrived = now();
+        for (int i = 0; i < count; ++i)
+        {
+            if (messages[i].msg_len < sizeof(Header))
+            {
+                continue;
+            }
+
+            Header header;
+            std::memcpy(&header, &sender.receiveBuffers[i * MAX_DATAGRAM_SIZE], sizeof(header));
+            if (header.sequence >= sender.sent || sender.echoed[header.sequence])
+            {
+                continue;
+            }
+
+            sender.echoed[header.sequence] = true;
+            ++sender.received;
+            sender.receivedBytes += messages[i].msg_len;
+            sender.rtt.record(arrived - header.sent);
+        }
+
+        if (static_cast<unsigned>(count) < batch)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * Waits for echoes until the given time.
+ */
+void collectUntil(Sender& sender, std::int64_t deadline)
+{
+    while (true)
+    {
+        collect(sender);
+        const std::int64_t left = deadline - now();
+        if (left <= 0)
+        {
+            return;
+        }
+
+        pollfd fd = {sender.socketfd, POLLIN, 0};
+        timespec timeout = {static_cast<time_t>(left / 1000000000), static_cast<long>(left % 1000000000)};
+        ppoll(&fd, 1, &timeout, nullptr);
+    }
+}
+
+/**
+ * Sends paced batches until told to stop, then waits a little for the last echoes.
+ */
+void run(Sender& sender)
+{
+    const std::atomic<bool>& stop = sender.stop;
+    const Settings& settings = sender.settings;
+    const std::int64_t interval = settings.rate > 0 ? static_cast<std::int64_t>(1e9 * settings.batch * settings.threads / settings.rate) : 0;
+    std::int64_t next = now();
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        if (interval > 0)
+        {
+            collectUntil(sender, next);
+            next += interval;
+        }
+
+        const std::int64_t sent = now();
+        for (unsigned i = 0; i < settings.batch; ++i)
+        {
+            Header header = {sender.sent + i, sent};
+            std::memcpy(&sender.sendBuffers[i * settings.size], &header, sizeof(header));
+        }
+
+        const int count = sendmmsg(sender.socketfd, sender.messages.data(), settings.batch, 0);
+        if (count > 0)
+        {
+            sender.sent += static_cast<unsigned>(count);
+            sender.echoed.resize(sender.sent, false);
+        }
+
+        collect(sender);
+    }
+
+    collectUntil(sender, now() + std::chrono::duration_cast<std::chrono::nanoseconds>(DRAIN_TIME).count());
+}
+
+bool parse(int argc, char** argv, Settings& settings)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const bool hasValue = (i + 1 < argc);
+        if (std::strcmp(argv[i], "--host") == 0 && hasValue)
+        {
+            if (inet_pton(AF_INET, argv[++i], &settings.host) != 1)
+            {
+                return false;
+            }
+        }
+        else if (std::strcmp(argv[i], "--size") == 0 && hasValue)
+        {
+            settings.size = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--rate") == 0 && hasValue)
+        {
+            settings.rate = std::stod(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && hasValue)
+        {
+            settings.threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--batch") == 0 && hasValue)
+        {
+            settings.batch = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--duration") == 0 && hasValue)
+        {
+            settings.duration = std::stod(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--quit") == 0)
+        {
+            settings.quit = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return settings.size >= sizeof(Header) && settings.size <= MAX_DATAGRAM_SIZE && settings.threads > 0 && settings.batch > 0;
+}
+
+int main(int argc, char **argv)
+{
+    Settings settings;
+    if (!parse(argc, argv, settings))
+    {
+        std::cerr << "Usage: " << argv[0] << " [--host A.B.C.D] [--size " << sizeof(Header) << ".." << MAX_DATAGRAM_SIZE
+                  << "] [--rate PPS] [--threads T] [--batch K] [--duration SECONDS] [--quit]" << std::endl;
+        return -1;
+    }
+
+    SequenceBlueprint<Sender> blueprint;
+
+    // Create socket.
+    blueprint.addStep(
+        [](Sender& sender)
+        {
+            sender.socketfd = socket(PF_INET, SOCK_DGRAM, 0);
+            return (sender.socketfd != -1);
+        },
+        [](Sender& sender)
+        {
+            close(sender.socketfd);
+        },
+        label("socket"));
+
+    // Make room for bursts of echoes. The kernel may grant less, which only costs drops.
+    blueprint.addStep(
+        [](Sender& sender)
+        {
+            int optval = SOCKET_BUFFER_SIZE;
+            setsockopt(sender.socketfd, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval));
+            setsockopt(sender.socketfd, SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval));
+            return true;
+        },
+        label("socket buffers"));
+
+    // Connect to the server, so that only its datagrams are received.
+    blueprint.addStep(
+        [](Sender& sender)
+        {
+            sockaddr_in serveraddr = {};
+            serveraddr.sin_family = AF_INET;
+            serveraddr.sin_addr = sender.settings.host;
+            serveraddr.sin_port = htons(PORT);
+            return (connect(sender.socketfd, (sockaddr*)&serveraddr, sizeof(serveraddr)) == 0);
+        },
+        label("connect"));
+
+    // Allocate the send batch, followed by the receive batch, once.
+    blueprint.addStep(
+        [](Sender& sender)
+        {
+            const unsigned batch = sender.settings.batch;
+            sender.sendBuffers.assign(batch * sender.settings.size, 0);
+            sender.receiveBuffers.assign(batch * MAX_DATAGRAM_SIZE, 0);
+            sender.iovecs.resize(2 * batch);
+            sender.messages.resize(2 * batch);
+            for (unsigned i = 0; i < 2 * batch; ++i)
+            {
+                const bool send = (i < batch);
+                sender.iovecs[i].iov_base = send ? &sender.sendBuffers[i * sender.settings.size] : &sender.receiveBuffers[(i - batch) * MAX_DATAGRAM_SIZE];
+                sender.iovecs[i].iov_len = send ? sender.settings.size : MAX_DATAGRAM_SIZE;
+                sender.messages[i] = {};
+                sender.messages[i].msg_hdr.msg_iov = &sender.iovecs[i];
+                sender.messages[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            return true;
+        },
+        [](Sender& sender)
+        {
+            sender.messages.clear();
+            sender.iovecs.clear();
+            sender.receiveBuffers.clear();
+            sender.sendBuffers.clear();
+        },
+        label("buffers"));
+
+    std::vector<std::unique_ptr<BlueprintInstance<Sender>>> senders;
+    SequentialRaii client;
+    for (unsigned i = 0; i < settings.threads; ++i)
+    {
+        senders.push_back(blueprint.instantiate(i, settings));
+        BlueprintInstance<Sender>* sender = senders.back().get();
+        client.addStep(
+            [sender]()
+            {
+                return sender->sequence().initialize();
+            },
+            [sender]()
+            {
+                sender->sequence().uninitialize();
+            },
+            label("sender socket"));
+    }
+
+    // Terminate the server once the senders are done, while their sockets are still open.
+    if (settings.quit)
+    {
+        client.addStep(
+            []()
+            {
+                return true;
+            },
+            [&]()
+            {
+                const char x = 'x';
+                send(senders.front()->context().socketfd, &x, 1, 0);
+            },
+            label("quit"));
+    }
+
+    // Start sending once every socket is up. Stopping waits for the last echoes.
+    for (auto& instance : senders)
+    {
+        Sender* sender = &instance->context();
+        client.addStep(
+            [sender]()
+            {
+                sender->thread = std::thread([sender]() {run(*sender);});
+                return true;
+            },
+            [sender]()
+            {
+                sender->stop.store(true, std::memory_order_relaxed);
+                sender->thread.join();
+            },
+            label("sender thread"));
+    }
+
+    InitResult result;
+    if (!client.initialize(result))
+    {
+        std::cerr << (result.label ? result.label : "step") << " " << result.failedStep << " failed: " << result.error.message() << std::endl;
+        return -1;
+    }
+
+    // Time the sending only, not setting the sockets up, and stop all senders at once so that none
+    // keeps sending while another one drains.
+    const std::int64_t start = now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(settings.duration));
+    for (auto& instance : senders)
+    {
+        instance->context().stop.store(true, std::memory_order_relaxed);
+    }
+
+    const double elapsed = (now() - start) / 1e9;
+
+    // Join the senders, then close their sockets. The statistics stay with the instances.
+    client.uninitialize();
+
+    std::uint64_t sent = 0;
+    std::uint64_t received = 0;
+    std::uint64_t receivedBytes = 0;
+    LatencyHistogram rtt;
+    for (auto& instance : senders)
+    {
+        const Sender& sender = instance->context();
+        sent += sender.sent;
+        received += sender.received;
+        receivedBytes += sender.receivedBytes;
+        rtt.merge(sender.rtt);
+    }
+
+    std::printf("sent     %12.0f pps\n", sent / elapsed);
+    std::printf("echoed   %12.0f pps  %8.3f Gbps\n", received / elapsed, receivedBytes * 8 / elapsed / 1e9);
+    std::printf("dropped  %12llu      %8.3f %%\n", static_cast<unsigned long long>(sent - received), sent > 0 ? 100.0 * (sent - received) / sent : 0.0);
+    if (rtt.total() > 0)
+    {
+        std::printf("rtt      p50 %.1f us  p99 %.1f us  p99.9 %.1f us\n", rtt.percentile(50) / 1e3, rtt.percentile(99) / 1e3, rtt.percentile(99.9) / 1e3);
+    }
+
+    return 0;
+}
@@ -1,14 +1,48 @@
 /**
  * Simple UDP echo server on port 1234. Will return whatever is thrown to it.
+ *
+ * Usage: udpserver [--shards N [--cbpf]] [--batch K | --uring | --offload] [--async-log]
+ * By default a single socket is served from the main thread. With --shards, N worker threads
+ * pinned to their own cores each serve their own socket, all bound to the same port with
+ * SO_REUSEPORT so that the kernel spreads the clients over them. Each shard's socket and buffers
+ * are set up on its worker's core, placing their memory on the worker's NUMA node. --cbpf additionally attaches a
+ * classic BPF program steering every datagram to the shard of the CPU it arrived on.
+ * With --batch, up to K datagrams are received with one recvmmsg() and echoed with one sendmmsg(),
+ * using message buffers allocated once per socket. With --uring, every socket is served through its
+ * own io_uring instead: one multishot recvmsg keeps receiving into a ring of provided buffers, and
+ * the echoes are queued as sendmsg requests, all submitted with a single io_uring_enter() per
+ * round of completions. Needs Linux 6.0 or later. With --offload, the kernel coalesces trains of
+ * datagrams from a client into one buffer (UDP_GRO), which is echoed with a single send that the
+ * kernel or NIC segments again (UDP_SEGMENT). Either option is skipped if the kernel rejects it.
+ * With --async-log, every shard logs the datagrams it echoes as fixed-size records to a ring of its
+ * own, which a background thread formats and writes in batches. Records are dropped and counted
+ * rather than waited for when a ring is full.
  */
 
 #include "../seqraii.h"
-#include <sys/types.h> 
+#include "../seqraii_blueprint.h"
+#include "asynclog.h"
+#include "uring.h"
+#include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 using namespace sequentialraii;
@@ -19,82 +53,962 @@ constexpr unsigned short PORT = 1234;
 // Receiving buffer max size.
 constexpr int MAX_BUFFER_SIZE = 1024;
 
+// Receiving buffer size with UDP_GRO, large enough for the biggest coalesced train.
+constexpr int OFFLOAD_BUFFER_SIZE = 65536;
+
+// Size of the io_uring queues, and number of provided receive buffers.
+constexpr unsigned URING_ENTRIES = 256;
+constexpr unsigned URING_BUFFERS = 256;
+
+// Provided receive buffers hold the recvmsg header and the client address before the data.
+constexpr unsigned URING_BUFFER_SIZE = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + MAX_BUFFER_SIZE;
+
+// Completions of the receive and the wakeup carry these tags, those of sends the id of the buffer
+// being sent.
+constexpr std::uint64_t URING_RECV_TAG = ~std::uint64_t(0);
+constexpr std::uint64_t URING_WAKE_TAG = ~std::uint64_t(1);
+
+/**
+ * Preallocated messages for batched receiving and sending, reused for every batch.
+ */
+struct MessageRing
+{
+    explicit MessageRing(unsigned size)
+        : buffers(size * MAX_BUFFER_SIZE)
+        , iovecs(size)
+        , addresses(size)
+        , messages(size)
+    {
+        for (unsigned i = 0; i < size; ++i)
+        {
+            iovecs[i].iov_base = &buffers[i * MAX_BUFFER_SIZE];
+            messages[i].msg_hdr = {};
+            messages[i].msg_hdr.msg_name = &addresses[i];
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        rearm(size);
+    }
+
+    /**
+     * Resets the first messages to full size after they were trimmed for sending.
+     */
+    void rearm(unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            iovecs[i].iov_len = MAX_BUFFER_SIZE;
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        }
+    }
+
+    unsigned size() const
+    {
+        return static_cast<unsigned>(messages.size());
+    }
+
+    std::vector<char> buffers;
+    std::vector<iovec> iovecs;
+    std::vector<sockaddr_in> addresses;
+    std::vector<mmsghdr> messages;
+};
+
+/**
+ * Send request of a datagram waiting in a provided buffer, alive until the send completes.
+ */
+struct UringSend
+{
+    msghdr message;
+    iovec data;
+};
+
+/**
+ * How sockets are served, from the command line.
+ */
+struct Mode
+{
+    unsigned batchSize = 0;
+    bool useUring = false;
+    bool offload = false;
+
+    // Where the shards log to, if asynchronously.
+    AsyncLog* log = nullptr;
+};
+
+/**
+ * State of one socket and the thread serving it.
+ */
+struct Shard
+{
+    Shard(unsigned index_, bool reusePort_, const Mode& mode_)
+        : index(index_)
+        , reusePort(reusePort_)
+        , mode(mode_)
+    {}
+
+    unsigned index;
+    bool reusePort;
+    Mode mode;
+    int socketfd = -1;
+
+    // Offloads the kernel accepted.
+    bool gro = false;
+    bool gso = false;
+    std::vector<char> offloadBuffer;
+
+    int wakefd = -1;
+    LogRing* logRing = nullptr;
+    MessageRing* ring = nullptr;
+    uring::Ring uring;
+    uring::BufferRing uringBuffers;
+    std::vector<UringSend> uringSends;
+    std::thread worker;
+};
+
+/**
+ * Lets any worker ask the main thread to shut the server down.
+ */
+class StopSignal
+{
+public:
+    void request()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_requested = true;
+        m_cv.notify_all();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() {return m_requested;});
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_requested = false;
+};
+
+/**
+ * Logs an echoed datagram to the shard's ring if it has one, otherwise prints it if verbose.
+ */
+void logDatagram(Shard& shard, const sockaddr_in& clientaddr, const char* data, std::size_t length, bool verbose)
+{
+    if (shard.logRing)
+    {
+        LogRecord record;
+        record.addr = clientaddr.sin_addr.s_addr;
+        record.port = clientaddr.sin_port;
+        record.length = static_cast<std::uint32_t>(length);
+        record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        shard.logRing->push(record);
+    }
+    else if (verbose)
+    {
+        std::cout << inet_ntoa(clientaddr.sin_addr) << ":" << ntohs(clientaddr.sin_port) << " -> ";
+        std::cout.write(data, length) << std::endl;
+    }
+}
+
+/**
+ * Echoes a single datagram.
+ * @param verbose Print every datagram, only sensible with a single socket.
+ * @return False when the server should terminate.
+ */
+bool echo(Shard& shard, bool verbose)
+{
+    const int socketfd = shard.socketfd;
+    std::vector<char> buffer(MAX_BUFFER_SIZE, 0);
+
+    // Read UDP datagram from the client.
+    sockaddr_in clientaddr;
+    socklen_t clientlen = sizeof(clientaddr);
+    int bytesRead = recvfrom(socketfd, buffer.data(), MAX_BUFFER_SIZE, 0, (sockaddr*)&clientaddr, &clientlen);
+    if (bytesRead <= 0)
+    {
+        // Zero means the socket was shut down.
+        return false;
+    }
+
+    // Print client ip:port <data>
+    logDatagram(shard, clientaddr, buffer.data(), bytesRead, verbose);
+
+    // Terminate on 'x' input.
+    if (bytesRead == 1 and buffer[0] == 'x')
+    {
+        return false;
+    }
+
+    // Return whatever was sent to us.
+    int bytesSent = sendto(socketfd, buffer.data(), bytesRead, 0, (sockaddr*)&clientaddr, clientlen);
+    return bytesSent >= 0;
+}
+
+/**
+ * Echoes a batch of datagrams, taking two syscalls however many arrived.
+ * @return False when the server should terminate.
+ */
+bool echoBatch(Shard& shard, bool verbose)
+{
+    const int socketfd = shard.socketfd;
+    MessageRing& ring = *shard.ring;
+
+    // Block for the first datagram only, then take whatever else is queued.
+    int received = recvmmsg(socketfd, ring.messages.data(), ring.size(), MSG_WAITFORONE, nullptr);
+    if (received <= 0)
+    {
+        return false;
+    }
+
+    // Trim every message to what was received, so that it is echoed as is.
+    bool terminate = false;
+    unsigned count = 0;
+    for (; count < static_cast<unsigned>(received); ++count)
+    {
+        const unsigned length = ring.messages[count].msg_len;
+        const char* data = static_cast<const char*>(ring.iovecs[count].iov_base);
+        logDatagram(shard, ring.addresses[count], data, length, verbose);
+
+        // Terminate on 'x' input, after echoing the datagrams before it.
+        if (length == 1 and data[0] == 'x')
+        {
+            terminate = true;
+            break;
+        }
+
+        ring.iovecs[count].iov_len = length;
+    }
+
+    for (unsigned sent = 0; sent < count; )
+    {
+        int result = sendmmsg(socketfd, ring.messages.data() + sent, count - sent, 0);
+        if (result < 0)
+        {
+            return false;
+        }
+
+        sent += static_cast<unsigned>(result);
+    }
+
+    ring.rearm(static_cast<unsigned>(received));
+    return !terminate;
+}
+
+/**
+ * Reports echoes that couldn't be sent, e.g. with EAGAIN on a full send buffer or EMSGSIZE for a
+ * train the path can't take. They are dropped, as UDP may, rather than stopping the server.
+ */
+void logDropped(const sockaddr_in& clientaddr, ssize_t length)
+{
+    std::cerr << "Dropped " << length << " bytes to " << inet_ntoa(clientaddr.sin_addr) << ":" << ntohs(clientaddr.sin_port)
+              << ": " << std::strerror(errno) << std::endl;
+}
+
+/**
+ * Echoes a datagram or, with UDP_GRO, a train of datagrams the kernel coalesced into one buffer.
+ * All datagrams of a train come from the same client and have the segment size reported in the
+ * control message, except for a shorter last one.
+ * @return False when the server should terminate.
+ */
+bool echoOffload(Shard& shard, bool verbose)
+{
+    std::vector<char>& buffer = shard.offloadBuffer;
+    sockaddr_in clientaddr;
+    iovec data = {buffer.data(), buffer.size()};
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        cmsghdr align;
+    } control;
+
+    msghdr message = {};
+    message.msg_name = &clientaddr;
+    message.msg_namelen = sizeof(clientaddr);
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    const ssize_t bytesRead = recvmsg(shard.socketfd, &message, 0);
+    if (bytesRead <= 0)
+    {
+        return false;
+    }
+
+    ssize_t segmentSize = bytesRead;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+        {
+            int size = 0;
+            std::memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            segmentSize = size;
+        }
+    }
+
+    // Terminate on 'x' input, after echoing the datagrams before it.
+    bool terminate = false;
+    ssize_t length = 0;
+    while (length < bytesRead)
+    {
+        const ssize_t size = std::min(segmentSize, bytesRead - length);
+        logDatagram(shard, clientaddr, &buffer[length], size, verbose);
+
+        if (size == 1 and buffer[length] == 'x')
+        {
+            terminate = true;
+            break;
+        }
+
+        length += size;
+    }
+
+    if (length > segmentSize && shard.gso)
+    {
+        // Return the whole train with one send, to be segmented again by the kernel or the NIC.
+        union
+        {
+            char buffer[CMSG_SPACE(sizeof(std::uint16_t))];
+            cmsghdr align;
+        } segment = {};
+
+        data.iov_len = length;
+        message.msg_control = segment.buffer;
+        message.msg_controllen = sizeof(segment.buffer);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+        const std::uint16_t gsoSize = static_cast<std::uint16_t>(segmentSize);
+        std::memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(gsoSize));
+        message.msg_namelen = sizeof(clientaddr);
+        if (sendmsg(shard.socketfd, &message, 0) < 0)
+        {
+            logDropped(clientaddr, length);
+        }
+
+        return !terminate;
+    }
+
+    // Return whatever was sent to us, datagram by datagram.
+    for (ssize_t offset = 0; offset < length; offset += segmentSize)
+    {
+        const ssize_t size = std::min(segmentSize, length - offset);
+        if (sendto(shard.socketfd, &buffer[offset], size, 0, (sockaddr*)&clientaddr, sizeof(clientaddr)) < 0)
+        {
+            logDropped(clientaddr, length - offset);
+            break;
+        }
+    }
+
+    return !terminate;
+}
+
+/**
+ * Echoes datagrams through the shard's io_uring until told to terminate. The socket is the ring's
+ * registered file 0, and the wakeup eventfd file 1.
+ */
+void echoUring(Shard& shard, bool verbose)
+{
+    uring::Ring& ring = shard.uring;
+    uring::BufferRing& buffers = shard.uringBuffers;
+
+    // Only the sizes matter to a multishot recvmsg, it must stay alive while the receive is armed.
+    msghdr receive = {};
+    receive.msg_namelen = sizeof(sockaddr_in);
+
+    auto armReceive = [&]()
+    {
+        io_uring_sqe* sqe = ring.sqe();
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->addr = reinterpret_cast<std::uint64_t>(&receive);
+        sqe->len = 1;
+        sqe->buf_group = buffers.group();
+        sqe->user_data = URING_RECV_TAG;
+    };
+
+    // Shutting the socket down doesn't end a multishot receive, other threads write the eventfd.
+    std::uint64_t wakeup = 0;
+    io_uring_sqe* wait = ring.sqe();
+    wait->opcode = IORING_OP_READ;
+    wait->fd = 1;
+    wait->flags = IOSQE_FIXED_FILE;
+    wait->addr = reinterpret_cast<std::uint64_t>(&wakeup);
+    wait->len = sizeof(wakeup);
+    wait->user_data = URING_WAKE_TAG;
+
+    armReceive();
+    bool running = true;
+    unsigned pendingSends = 0;
+    while (running || pendingSends > 0)
+    {
+        if (ring.submitAndWait(1) < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        bool rearm = false;
+        ring.forEachCompletion(
+            [&](const io_uring_cqe& cqe)
+            {
+                if (cqe.user_data == URING_WAKE_TAG)
+                {
+                    running = false;
+                    return;
+                }
+
+                if (cqe.user_data != URING_RECV_TAG)
+                {
+                    --pendingSends;
+                    buffers.recycle(static_cast<unsigned>(cqe.user_data));
+                    return;
+                }
+
+                // The receive stops when it runs out of buffers, and has to be armed again.
+                rearm = rearm || !(cqe.flags & IORING_CQE_F_MORE);
+                if (cqe.res == -ENOBUFS)
+                {
+                    return;
+                }
+
+                if (cqe.res <= 0)
+                {
+                    // Zero means the socket was shut down.
+                    running = false;
+                    return;
+                }
+
+                const unsigned id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                char* buffer = buffers.buffer(id);
+                const io_uring_recvmsg_out* out = reinterpret_cast<const io_uring_recvmsg_out*>(buffer);
+                sockaddr_in* clientaddr = reinterpret_cast<sockaddr_in*>(buffer + sizeof(*out));
+                char* data = buffer + sizeof(*out) + receive.msg_namelen + receive.msg_controllen;
+
+                logDatagram(shard, *clientaddr, data, out->payloadlen, verbose);
+
+                // Terminate on 'x' input, once the echoes already queued have been sent.
+                if (!running || (out->payloadlen == 1 and data[0] == 'x'))
+                {
+                    running = false;
+                    buffers.recycle(id);
+                    return;
+                }
+
+                // Return whatever was sent to us, straight from the receive buffer.
+                UringSend& send = shard.uringSends[id];
+                send.data.iov_base = data;
+                send.data.iov_len = out->payloadlen;
+                send.message = {};
+                send.message.msg_name = clientaddr;
+                send.message.msg_namelen = sizeof(sockaddr_in);
+                send.message.msg_iov = &send.data;
+                send.message.msg_iovlen = 1;
+
+                io_uring_sqe* sqe = ring.sqe();
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = 0;
+                sqe->flags = IOSQE_FIXED_FILE;
+                sqe->addr = reinterpret_cast<std::uint64_t>(&send.message);
+                sqe->len = 1;
+                sqe->user_data = id;
+                ++pendingSends;
+            });
+
+        if (running && rearm)
+        {
+            armReceive();
+        }
+    }
+}
+
+/**
+ * Serves the shard's socket until told to terminate.
+ */
+void serve(Shard& shard, bool verbose)
+{
+    if (shard.mode.useUring)
+    {
+        echoUring(shard, verbose);
+        return;
+    }
+
+    if (shard.mode.offload)
+    {
+        while (echoOffload(shard, verbose))
+        {
+        }
+
+        return;
+    }
+
+    while (shard.ring ? echoBatch(shard, verbose) : echo(shard, verbose))
+    {
+    }
+}
+
+/**
+ * Pins the calling thread to a single core.
+ */
+bool pinToCore(unsigned core)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+/**
+ * @return CPUs the process may run on, which taskset or a cpuset may have narrowed down.
+ */
+std::vector<unsigned> allowedCpus()
+{
+    std::vector<unsigned> cpus;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    if (cpus.empty())
+    {
+        cpus.push_back(0);
+    }
+
+    return cpus;
+}
+
+/**
+ * Prints which step failed and why.
+ */
+void printFailure(const InitResult& result)
+{
+    std::cerr << (result.label ? result.label : "step") << " " << result.failedStep << " failed: " << result.error.message() << std::endl;
+}
+
+/**
+ * Runs the given number of shards until one of them is told to terminate.
+ */
+int runSharded(const SequenceBlueprint<Shard>& blueprint, unsigned shardCount, bool cbpf, const Mode& mode)
+{
+    const std::vector<unsigned> cpus = allowedCpus();
+    StopSignal stop;
+    std::vector<std::unique_ptr<BlueprintInstance<Shard>>> shards;
+    std::vector<InitResult> shardResults(shardCount);
+    SequentialRaii server;
+
+    // Bring up the sockets in shard order, which is also their order in the reuseport group.
+    for (unsigned i = 0; i < shardCount; ++i)
+    {
+        shards.push_back(blueprint.instantiate(i, true, mode));
+        BlueprintInstance<Shard>* shard = shards.back().get();
+
+        // Set the socket and its buffers up on the core the worker will run on, so that they are
+        // allocated on its NUMA node rather than the main thread's.
+        shard->sequence().setAffinity(affinity({cpus[i % cpus.size()]}));
+        InitResult* shardResult = &shardResults[i];
+        server.addStep(
+            [shard, shardResult]()
+            {
+                return shard->sequence().initialize(*shardResult);
+            },
+            [shard]()
+            {
+                shard->sequence().uninitialize();
+            },
+            label("shard socket"));
+    }
+
+    // Steer each datagram to socket (cpu % shards) of the group. Applies to the whole group and
+    // goes away with the sockets.
+    if (cbpf)
+    {
+        server.addStep(
+            [&]()
+            {
+                sock_filter code[] = {
+                    {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<__u32>(SKF_AD_OFF + SKF_AD_CPU)},
+                    {BPF_ALU | BPF_MOD | BPF_K, 0, 0, shardCount},
+                    {BPF_RET | BPF_A, 0, 0, 0},
+                };
+                sock_fprog program = {};
+                program.len = sizeof(code) / sizeof(code[0]);
+                program.filter = code;
+
+                const int socketfd = shards.front()->context().socketfd;
+                return (setsockopt(socketfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == 0);
+            },
+            label("reuseport cbpf"));
+    }
+
+    // Start the workers last, so that they only ever see fully set up sockets. Shutting a socket
+    // down wakes its worker up, io_uring workers are woken up through their eventfd.
+    for (auto& instance : shards)
+    {
+        Shard* shard = &instance->context();
+        const unsigned cpu = cpus[shard->index % cpus.size()];
+        server.addStep(
+            [shard, cpu, &stop]()
+            {
+                shard->worker = std::thread(
+                    [shard, cpu, &stop]()
+                    {
+                        pinToCore(cpu);
+                        serve(*shard, false);
+                        stop.request();
+                    });
+                return true;
+            },
+            [shard]()
+            {
+                shutdown(shard->socketfd, SHUT_RDWR);
+                if (shard->wakefd != -1)
+                {
+                    const std::uint64_t one = 1;
+                    const ssize_t written = write(shard->wakefd, &one, sizeof(one));
+                    (void)written;
+                }
+
+                shard->worker.join();
+            },
+            label("shard worker"));
+    }
+
+    InitResult result;
+    if (!server.initialize(result))
+    {
+        // The shards' sockets come first, and fail on a step of their own sequence.
+        if (result.failedStep < shardCount)
+        {
+            std::cerr << "shard " << result.failedStep << ": ";
+            printFailure(shardResults[result.failedStep]);
+        }
+        else
+        {
+            printFailure(result);
+        }
+
+        return -1;
+    }
+
+    std::cout << "Serving port " << PORT << " with " << shardCount << " shards" << std::endl;
+    stop.wait();
+
+    // Clean up and leave: workers first, then the sockets they used.
+    server.uninitialize();
+
+    return 0;
+}
+
+/**
+ * Prints how to call the server.
+ * @return Exit code for wrong arguments.
+ */
+int usage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--shards N [--cbpf]] [--batch K | --uring | --offload] [--async-log]" << std::endl;
+    return -1;
+}
+
 int main(int argc, char **argv)
 {
-    int socketfd;
-    SequentialRaii udp;
+    unsigned shards = 0;
+    bool cbpf = false;
+    bool asyncLog = false;
+    Mode mode;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+        {
+            shards = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--cbpf") == 0)
+        {
+            cbpf = true;
+        }
+        else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            mode.batchSize = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--uring") == 0)
+        {
+            mode.useUring = true;
+        }
+        else if (std::strcmp(argv[i], "--offload") == 0)
+        {
+            mode.offload = true;
+        }
+        else if (std::strcmp(argv[i], "--async-log") == 0)
+        {
+            asyncLog = true;
+        }
+        else
+        {
+            return usage(argv[0]);
+        }
+    }
+
+    // One way of echoing at a time, and steering only between shards.
+    const int echoModes = (mode.batchSize > 0) + mode.useUring + mode.offload;
+    if (echoModes > 1 || (cbpf && shards == 0))
+    {
+        return usage(argv[0]);
+    }
+
+    SequenceBlueprint<Shard> blueprint;
 
     // Create socket.
-    udp.addStep(
-        [&]()
+    blueprint.addStep(
+        [](Shard& shard)
         {
-            socketfd = socket(PF_INET, SOCK_DGRAM, 0);
-            return (socketfd != -1);
+            shard.socketfd = socket(PF_INET, SOCK_DGRAM, 0);
+            return (shard.socketfd != -1);
         },
-        [&]()
+        [](Shard& shard)
         {
-            close(socketfd);
+            close(shard.socketfd);
         });
 
     // Allow reuse of address.
-    udp.addStep(
-        [&]()
+    blueprint.addStep(
+        [](Shard& shard)
         {
             int optval = 1;
-            return (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, static_cast<void*>(&optval), sizeof(int)) !=-1);
+            return (setsockopt(shard.socketfd, SOL_SOCKET, SO_REUSEADDR, static_cast<void*>(&optval), sizeof(int)) !=-1);
+        });
+
+    // Let the shards share the port.
+    blueprint.addStep(
+        [](Shard& shard)
+        {
+            int optval = 1;
+            return !shard.reusePort || (setsockopt(shard.socketfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) != -1);
         });
 
     // Construct server address and bind to the given port.
-    udp.addStep(
-        [&]()
+    blueprint.addStep(
+        [](Shard& shard)
         {
             sockaddr_in serveraddr = {};    // server address.
             serveraddr.sin_family = AF_INET;
             serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
             serveraddr.sin_port = htons(PORT);
 
-            return (bind(socketfd, (sockaddr*)&serveraddr, sizeof(serveraddr)) == 0);
+            return (bind(shard.socketfd, (sockaddr*)&serveraddr, sizeof(serveraddr)) == 0);
         });
 
-    if (!udp.initialize())
-    {
-        return -1;
-    }
+    // Receive trains of datagrams coalesced by UDP_GRO. Without kernel support datagrams keep
+    // arriving one by one, so the step doesn't fail.
+    blueprint.addStep(
+        [](Shard& shard)
+        {
+            if (!shard.mode.offload)
+            {
+                return true;
+            }
 
-    // Enter echo loop.
-    while (true)
-    {
-        std::vector<char> buffer(MAX_BUFFER_SIZE, 0);
+            shard.offloadBuffer.resize(OFFLOAD_BUFFER_SIZE);
+            int optval = 1;
+            shard.gro = (setsockopt(shard.socketfd, SOL_UDP, UDP_GRO, &optval, sizeof(optval)) == 0);
+            if (!shard.gro)
+            {
+                std::cerr << "UDP_GRO not supported: " << std::strerror(errno) << std::endl;
+            }
 
-        // Read UDP datagram from the client.
-        sockaddr_in clientaddr;
-        socklen_t clientlen = sizeof(clientaddr);
-        int bytesRead = recvfrom(socketfd, buffer.data(), MAX_BUFFER_SIZE, 0, (sockaddr*)&clientaddr, &clientlen);
-        if (bytesRead < 0)
+            return true;
+        },
+        [](Shard& shard)
         {
-            break;
-        }
+            shard.offloadBuffer = std::vector<char>();
+            shard.gro = false;
+        },
+        label("udp gro"));
 
-        // Print client ip:port <data>
-        std::cout << inet_ntoa(clientaddr.sin_addr) << ":" << ntohs(clientaddr.sin_port) << " -> " << buffer.data() << std::endl;
+    // Send coalesced trains back with UDP_SEGMENT, probed by setting the socket's default segment
+    // size to 0, i.e. none. Without kernel support trains are split and sent datagram by datagram.
+    blueprint.addStep(
+        [](Shard& shard)
+        {
+            if (!shard.mode.offload)
+            {
+                return true;
+            }
+
+            int optval = 0;
+            shard.gso = (setsockopt(shard.socketfd, SOL_UDP, UDP_SEGMENT, &optval, sizeof(optval)) == 0);
+            if (!shard.gso)
+            {
+                std::cerr << "UDP_SEGMENT not supported: " << std::strerror(errno) << std::endl;
+            }
 
-        // Terminate on 'x' input.
-        if (bytesRead == 1 and buffer[0] == 'x')
+            return true;
+        },
+        [](Shard& shard)
         {
-            break;
-        }
+            shard.gso = false;
+        },
+        label("udp gso"));
 
-        // Return whatever was sent to us.
-        int bytesSent = sendto(socketfd, buffer.data(), bytesRead, 0, (sockaddr*)&clientaddr, clientlen);
-        if (bytesSent < 0)
+    // Allocate the message buffers for batched echo once.
+    blueprint.addStep(
+        [](Shard& shard)
         {
-            break;
-        }
+            if (shard.mode.batchSize > 0)
+            {
+                shard.ring = new MessageRing(shard.mode.batchSize);
+            }
+
+            return true;
+        },
+        [](Shard& shard)
+        {
+            delete shard.ring;
+            shard.ring = nullptr;
+        });
+
+    // Set up the io_uring instance serving the socket.
+    blueprint.addStep(
+        [](Shard& shard)
+        {
+            return !shard.mode.useUring || shard.uring.setup(URING_ENTRIES);
+        },
+        [](Shard& shard)
+        {
+            shard.uring.teardown();
+        },
+        label("io_uring setup"));
+
+    // Provide the receive buffers to the kernel, with a send request for each.
+    blueprint.addStep(
+        [](Shard& shard)
+        {
+            if (!shard.mode.useUring)
+            {
+                return true;
+            }
+
+            shard.uringSends.resize(URING_BUFFERS);
+            return shard.uringBuffers.setup(shard.uring, URING_BUFFERS, URING_BUFFER_SIZE, 0);
+        },
+        [](Shard& shard)
+        {
+            shard.uringBuffers.teardown();
+            shard.uringSends.clear();
+        },
+        label("io_uring buffers"));
+
+    // Let other threads wake up the thread waiting on the io_uring.
+    blueprint.addStep(
+        [](Shard& shard)
+        {
+            if (!shard.mode.useUring)
+            {
+                return true;
+            }
+
+            shard.wakefd = eventfd(0, EFD_CLOEXEC);
+            return (shard.wakefd != -1);
+        },
+        [](Shard& shard)
+        {
+            if (shard.wakefd != -1)
+            {
+                close(shard.wakefd);
+                shard.wakefd = -1;
+            }
+        },
+        label("io_uring wakeup"));
+
+    // Register the socket and the eventfd, sparing the kernel the file lookup on every request.
+    blueprint.addStep(
+        [](Shard& shard)
+        {
+            const int fds[] = {shard.socketfd, shard.wakefd};
+            return !shard.mode.useUring || uring::registerFiles(shard.uring, fds, 2);
+        },
+        [](Shard& shard)
+        {
+            if (shard.mode.useUring)
+            {
+                uring::unregisterFiles(shard.uring);
+            }
+        },
+        label("io_uring files"));
+
+    // Give the shard its own log ring, written out when the shard goes away.
+    blueprint.addStep(
+        [](Shard& shard)
+        {
+            if (shard.mode.log)
+            {
+                shard.logRing = shard.mode.log->open();
+            }
+
+            return true;
+        },
+        [](Shard& shard)
+        {
+            if (shard.logRing)
+            {
+                shard.mode.log->close(shard.logRing);
+                shard.logRing = nullptr;
+            }
+        },
+        label("log ring"));
+
+    // Run the log writer around everything else, so that it outlives every shard logging to it.
+    AsyncLog log;
+    SequentialRaii logging;
+    if (asyncLog)
+    {
+        mode.log = &log;
+        logging.addStep(
+            [&]()
+            {
+                return log.start();
+            },
+            [&]()
+            {
+                log.stop();
+            },
+            label("log writer"));
+    }
+
+    if (!logging.initialize())
+    {
+        std::cerr << "Could not start the log writer" << std::endl;
+        return -1;
     }
 
+    if (shards > 0)
+    {
+        return runSharded(blueprint, shards, cbpf, mode);
+    }
+
+    auto udp = blueprint.instantiate(0u, false, mode);
+    InitResult result;
+    if (!udp->sequence().initialize(result))
+    {
+        printFailure(result);
+        return -1;
+    }
+
+    // Enter echo loop.
+    serve(udp->context(), true);
+
     // Clean up and leave.
-    udp.uninitialize();
+    udp->sequence().uninitialize();
 
     return 0;
 }
-
@@ -0,0 +1,341 @@
+/**
+ * Minimal io_uring wrapper for the UDP echo server example, built directly on the system calls
+ * from <linux/io_uring.h>. Every resource is set up and torn down by a separate pair of calls, so
+ * that each can be a SequentialRaii step.
+ */
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace uring
+{
+inline int setup(unsigned entries, io_uring_params* params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+inline int enter(int ringfd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, ringfd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+inline int registerResource(int ringfd, unsigned opcode, const void* arg, unsigned count)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, ringfd, opcode, arg, count));
+}
+
+/**
+ * Submission and completion queues of one io_uring instance, used from a single thread.
+ */
+class Ring
+{
+public:
+    /**
+     * Creates the ring and maps its queues. Leaves errno set on failure.
+     */
+    bool setup(unsigned entries)
+    {
+        io_uring_params params = {};
+        m_fd = uring::setup(entries, &params);
+        if (m_fd < 0)
+        {
+            return false;
+        }
+
+        m_sqBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cqBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        m_singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (m_singleMap)
+        {
+            m_sqBytes = m_cqBytes = (m_sqBytes > m_cqBytes ? m_sqBytes : m_cqBytes);
+        }
+
+        m_sq = map(m_sqBytes, IORING_OFF_SQ_RING);
+        m_cq = m_singleMap ? m_sq : map(m_cqBytes, IORING_OFF_CQ_RING);
+        m_sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe*>(map(m_sqesBytes, IORING_OFF_SQES));
+        if (!m_sq || !m_cq || !m_sqes)
+        {
+            const int error = errno;
+            teardown();
+            errno = error;
+            return false;
+        }
+
+        m_sqHead = field(m_sq, params.sq_off.head);
+        m_sqTail = field(m_sq, params.sq_off.tail);
+        m_sqMask = *field(m_sq, params.sq_off.ring_mask);
+        m_sqEntries = params.sq_entries;
+        m_cqHead = field(m_cq, params.cq_off.head);
+        m_cqTail = field(m_cq, params.cq_off.tail);
+        m_cqMask = *field(m_cq, params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(m_cq) + params.cq_off.cqes);
+
+        // Submission queue entries are used in order, so the indirection array is the identity.
+        unsigned* array = field(m_sq, params.sq_off.array);
+        for (unsigned i = 0; i < m_sqEntries; ++i)
+        {
+            array[i] = i;
+        }
+
+        m_tail = *m_sqTail;
+        m_submitted = m_tail;
+        return true;
+    }
+
+    void teardown()
+    {
+        unmap(m_sqes, m_sqesBytes);
+        if (!m_singleMap)
+        {
+            unmap(m_cq, m_cqBytes);
+        }
+
+        unmap(m_sq, m_sqBytes);
+        m_sqes = nullptr;
+        m_cq = nullptr;
+        m_sq = nullptr;
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    /**
+     * @return Cleared submission queue entry, submitting queued ones first if there is no room.
+     */
+    io_uring_sqe* sqe()
+    {
+        while (m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+        {
+            submitAndWait(0);
+        }
+
+        io_uring_sqe* entry = &m_sqes[m_tail & m_sqMask];
+        std::memset(entry, 0, sizeof(*entry));
+        ++m_tail;
+        return entry;
+    }
+
+    /**
+     * Submits all queued entries and waits for the given number of completions, in one system call.
+     */
+    int submitAndWait(unsigned minComplete)
+    {
+        __atomic_store_n(m_sqTail, m_tail, __ATOMIC_RELEASE);
+        const unsigned toSubmit = m_tail - m_submitted;
+        m_submitted = m_tail;
+        return enter(m_fd, toSubmit, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0);
+    }
+
+    /**
+     * Hands every available completion to the handler, which may queue new entries.
+     */
+    template <class Handler>
+    void forEachCompletion(Handler&& handler)
+    {
+        unsigned head = *m_cqHead;
+        const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            handler(m_cqes[head & m_cqMask]);
+        }
+
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    void* map(std::size_t bytes, off_t offset)
+    {
+        void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        return memory == MAP_FAILED ? nullptr : memory;
+    }
+
+    static void unmap(void* memory, std::size_t bytes)
+    {
+        if (memory)
+        {
+            munmap(memory, bytes);
+        }
+    }
+
+    static unsigned* field(void* ring, unsigned offset)
+    {
+        return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+    }
+
+    int m_fd = -1;
+    bool m_singleMap = false;
+    void* m_sq = nullptr;
+    void* m_cq = nullptr;
+    io_uring_sqe* m_sqes = nullptr;
+    std::size_t m_sqBytes = 0;
+    std::size_t m_cqBytes = 0;
+    std::size_t m_sqesBytes = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    /// Local submission tail, and how much of it was submitted already.
+    unsigned m_tail = 0;
+    unsigned m_submitted = 0;
+};
+
+/**
+ * Ring of buffers provided to the kernel, from which receives pick a buffer when data arrives.
+ */
+class BufferRing
+{
+public:
+    /**
+     * Allocates the buffers and registers them as buffer group with the ring.
+     * @param count Number of buffers, a power of two.
+     */
+    bool setup(const Ring& ring, unsigned count, unsigned size, unsigned short group)
+    {
+        m_count = count;
+        m_size = size;
+        m_group = group;
+        m_bytes = count * sizeof(io_uring_buf) + static_cast<std::size_t>(count) * size;
+
+        // The ring itself has to be page aligned, which mmap guarantees.
+        void* memory = mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            return false;
+        }
+
+        m_ring = static_cast<io_uring_buf_ring*>(memory);
+        m_buffers = static_cast<char*>(memory) + count * sizeof(io_uring_buf);
+
+        io_uring_buf_reg registration = {};
+        registration.ring_addr = reinterpret_cast<std::uint64_t>(m_ring);
+        registration.ring_entries = count;
+        registration.bgid = group;
+        if (registerResource(ring.fd(), IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+        {
+            const int error = errno;
+            munmap(memory, m_bytes);
+            m_ring = nullptr;
+            errno = error;
+            return false;
+        }
+
+        m_ringfd = ring.fd();
+        for (unsigned i = 0; i < count; ++i)
+        {
+            add(i);
+        }
+
+        publish();
+        return true;
+    }
+
+    void teardown()
+    {
+        if (m_ringfd >= 0)
+        {
+            io_uring_buf_reg registration = {};
+            registration.bgid = m_group;
+            registerResource(m_ringfd, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+            m_ringfd = -1;
+        }
+
+        if (m_ring)
+        {
+            munmap(m_ring, m_bytes);
+            m_ring = nullptr;
+        }
+    }
+
+    unsigned count() const
+    {
+        return m_count;
+    }
+
+    unsigned short group() const
+    {
+        return m_group;
+    }
+
+    char* buffer(unsigned id) const
+    {
+        return m_buffers + static_cast<std::size_t>(id) * m_size;
+    }
+
+    /**
+     * Gives a buffer picked by a receive back to the kernel.
+     */
+    void recycle(unsigned id)
+    {
+        add(id);
+        publish();
+    }
+
+private:
+    void add(unsigned id)
+    {
+        io_uring_buf& entry = entries()[m_tail & (m_count - 1)];
+        entry.addr = reinterpret_cast<std::uint64_t>(buffer(id));
+        entry.len = m_size;
+        entry.bid = static_cast<unsigned short>(id);
+        ++m_tail;
+    }
+
+    void publish()
+    {
+        // The tail overlays the reserved field of the first entry.
+        __atomic_store_n(&entries()[0].resv, m_tail, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * The ring as a plain array of entries. The header declares it through a flexible array,
+     * which C++ compilers place 8 bytes off from where the kernel expects it.
+     */
+    io_uring_buf* entries() const
+    {
+        return reinterpret_cast<io_uring_buf*>(m_ring);
+    }
+
+    int m_ringfd = -1;
+    io_uring_buf_ring* m_ring = nullptr;
+    char* m_buffers = nullptr;
+    std::size_t m_bytes = 0;
+    unsigned m_count = 0;
+    unsigned m_size = 0;
+    unsigned short m_group = 0;
+    unsigned short m_tail = 0;
+};
+
+/**
+ * Registers file descriptors with the ring, to be used by index with IOSQE_FIXED_FILE.
+ */
+inline bool registerFiles(const Ring& ring, const int* fds, unsigned count)
+{
+    return registerResource(ring.fd(), IORING_REGISTER_FILES, fds, count) == 0;
+}
+
+inline void unregisterFiles(const Ring& ring)
+{
+    registerResource(ring.fd(), IORING_UNREGISTER_FILES, nullptr, 0);
+}
+
+} // Namespace uring
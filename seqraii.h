@@ -9,93 +9,2816 @@
 
 #include <vector>
 #include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#define SEQRAII_HAS_AFFINITY 1
+#else
+#define SEQRAII_HAS_AFFINITY 0
+#endif
+
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#define SEQRAII_HAS_MEMORY_RESOURCE 1
+#else
+#define SEQRAII_HAS_MEMORY_RESOURCE 0
+#endif
+
+// Builds without exceptions, e.g. -fno-exceptions, are detected. Define SEQRAII_HAS_EXCEPTIONS to 0
+// to leave out all exception handling anyway: steps then report failure only through their
+// return value, an exception escaping a step terminates, and so does running out of memory.
+#ifndef SEQRAII_HAS_EXCEPTIONS
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define SEQRAII_HAS_EXCEPTIONS 1
+#else
+#define SEQRAII_HAS_EXCEPTIONS 0
+#endif
+#endif
+
+#if SEQRAII_HAS_EXCEPTIONS
+#define SEQRAII_TRY try
+#define SEQRAII_CATCH_ALL catch (...)
+#define SEQRAII_THROW(exception) throw exception
+#else
+#define SEQRAII_TRY if (true)
+#define SEQRAII_CATCH_ALL else
+#define SEQRAII_THROW(exception) std::abort()
+#endif
 
 namespace sequentialraii
 {
+// Forward declaration of the base class of awaitable steps, defined in seqraii_async.h.
+class AsyncStepBase;
+class RangeStepBase;
+
+/**
+ * Asks initialize() to stop, once a StopSource requests it or a deadline passes. Checked between
+ * steps, and passed to initialization lambdas taking a const StopToken& so that long-running steps
+ * can give up early. Tokens are cheap to pass by reference; a default constructed one never stops.
+ */
+class StopToken
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    StopToken() noexcept = default;
+
+    /**
+     * Token asking to stop once the deadline has passed.
+     */
+    explicit StopToken(Clock::time_point deadline) noexcept
+        : m_deadline(deadline)
+    {}
+
+    /**
+     * @return True once a stop was requested or the deadline has passed.
+     */
+    bool stopRequested() const noexcept
+    {
+        return (m_state && m_state->load(std::memory_order_acquire)) || timedOut();
+    }
+
+    /**
+     * @return True once the deadline has passed.
+     */
+    bool timedOut() const noexcept
+    {
+        return m_deadline != Clock::time_point::max() && Clock::now() >= m_deadline;
+    }
+
+    /**
+     * @return Deadline of the token, Clock::time_point::max() if it has none.
+     */
+    Clock::time_point deadline() const noexcept
+    {
+        return m_deadline;
+    }
+
+private:
+    friend class StopSource;
+
+    StopToken(std::shared_ptr<const std::atomic<bool>> state, Clock::time_point deadline) noexcept
+        : m_state(std::move(state))
+        , m_deadline(deadline)
+    {}
+
+    std::shared_ptr<const std::atomic<bool>> m_state;
+    Clock::time_point m_deadline = Clock::time_point::max();
+};
+
+/**
+ * Requests a stop from any thread, for all tokens handed out by token().
+ */
+class StopSource
+{
+public:
+    StopSource()
+        : m_state(std::make_shared<std::atomic<bool>>(false))
+    {}
+
+    void requestStop() noexcept
+    {
+        m_state->store(true, std::memory_order_release);
+    }
+
+    bool stopRequested() const noexcept
+    {
+        return m_state->load(std::memory_order_acquire);
+    }
+
+    /**
+     * @param deadline Optional deadline after which the token asks to stop regardless.
+     */
+    StopToken token(StopToken::Clock::time_point deadline = StopToken::Clock::time_point::max()) const noexcept
+    {
+        return StopToken(m_state, deadline);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> m_state;
+};
+
+/**
+ * Details of a failed initialization, see SequentialRaii::initialize(InitResult&).
+ */
+struct InitResult
+{
+    /// Value of failedStep when no step failed.
+    static constexpr std::size_t kNoStep = static_cast<std::size_t>(-1);
+
+    /// Index of the step that failed, in the order steps were added.
+    std::size_t failedStep = kNoStep;
+
+    /// Label of the step that failed, if it was given one.
+    const char* label = nullptr;
+
+    /// Index of the item that failed within a range of steps, see SequentialRaii::addSteps().
+    std::size_t failedItem = kNoStep;
+
+    /// Error code returned by the step, or errno as the step left it. std::errc::timed_out or
+    /// std::errc::operation_canceled if initialization was stopped during or after the step.
+    std::error_code error;
+
+    /// Exception thrown by the step, if any.
+    std::exception_ptr exception;
+
+    explicit operator bool() const noexcept
+    {
+        return failedStep == kNoStep;
+    }
+};
+
 /**
- * Base class used for storing templated objects inside a vector.
+ * Base class used for storing templated objects inside the step storage.
  */
 class StepBase
 {
 public:
     virtual ~StepBase() noexcept = default;
 
-    virtual bool init() noexcept = 0;
-    virtual void uninit() noexcept = 0;
+    /**
+     * Runs the initialization code.
+     * @param result Receives the error or exception of a failure. Null when the caller doesn't care.
+     * @param stop Token for steps that take one. Null when initialization can't be stopped.
+     */
+    virtual bool init(InitResult* result, const StopToken* stop) noexcept = 0;
+    virtual void uninit() noexcept = 0;
+
+    /**
+     * Move-constructs this step into the storage at the same offset from newBase as it has from
+     * oldBase, and destroys the original. Only called for nothrow move constructible steps.
+     * @return The relocated step.
+     */
+    virtual StepBase* relocate(unsigned char* oldBase, unsigned char* newBase) noexcept = 0;
+
+    /**
+     * @return This step if its initialization is awaitable, see seqraii_async.h. Null otherwise.
+     */
+    virtual AsyncStepBase* asAsync() noexcept
+    {
+        return nullptr;
+    }
+
+    /**
+     * @return This step if it stands for a range of items, see SequentialRaii::addSteps(). Null otherwise.
+     */
+    virtual RangeStepBase* asRange() noexcept
+    {
+        return nullptr;
+    }
+
+    /**
+     * @return Label given when adding the step, see label(). Null if none was given.
+     */
+    const char* label() const noexcept
+    {
+        return m_label;
+    }
+
+    void setLabel(const char* label) noexcept
+    {
+        m_label = label;
+    }
+
+private:
+    const char* m_label = nullptr;
+};
+
+// Forward declarations.
+template <class Init, class Uninit> class Step;
+template <class Init, class Uninit> class LazyStep;
+template <class Init, class Uninit> class RangeStep;
+template <class Init, class Uninit> class AsyncStep;
+template <class T> class Task;
+template <class Context> class SequenceBlueprint;
+class SequentialRaii;
+
+/**
+ * Interface for running initialization steps concurrently, see SequentialRaii::initialize(Executor&).
+ * A ThreadPool implementation is provided in seqraii_threadpool.h.
+ */
+class Executor
+{
+public:
+    virtual ~Executor() noexcept = default;
+
+    /**
+     * Runs a task, typically on another thread. May also run it right away on the calling thread.
+     */
+    virtual void execute(std::function<void()> task) = 0;
+};
+
+/**
+ * Takes over initialized sequences to uninitialize them later, typically on another thread, see
+ * SequentialRaii::retireAsync(). BackgroundReaper in seqraii_reaper.h is one implementation.
+ */
+class Reaper
+{
+public:
+    virtual ~Reaper() noexcept = default;
+
+    /**
+     * Takes the steps of an initialized sequence, to be uninitialized in reverse order later.
+     * @return True if the sequence was taken and is now empty. False if the reaper refused it,
+     *         leaving the sequence untouched.
+     */
+    virtual bool retire(SequentialRaii& sequence) noexcept = 0;
+};
+
+/**
+ * Identifies a step within the SequentialRaii it was added to.
+ */
+struct StepHandle
+{
+    std::size_t index;
+};
+
+/**
+ * Position in the step list, see SequentialRaii::checkpoint(). Steps added after the checkpoint
+ * was taken form its tail.
+ */
+struct Checkpoint
+{
+    std::size_t index;
+};
+
+/**
+ * Base class of steps whose initialization is deferred until first use, see
+ * SequentialRaii::addLazyStep().
+ */
+class LazyStepBase : public StepBase
+{
+public:
+    /**
+     * Runs the deferred initialization unless it already ran. Thread-safe.
+     * @return True if the step is initialized, false if its initialization failed or the step is
+     *         not part of an initialized sequence.
+     */
+    virtual bool acquire() noexcept = 0;
+};
+
+/**
+ * Identifies a lazy step, see SequentialRaii::addLazyStep(). Stays valid when the SequentialRaii
+ * is moved, for as long as the step exists.
+ */
+struct LazyHandle : StepHandle
+{
+    LazyHandle(StepHandle handle, LazyStepBase* step_) noexcept
+        : StepHandle(handle)
+        , step(step_)
+    {}
+
+    /**
+     * Initializes the step on first use, see LazyStepBase::acquire().
+     */
+    bool acquire() const noexcept
+    {
+        return step->acquire();
+    }
+
+    LazyStepBase* step;
+};
+
+/**
+ * Set of steps a new step depends on, see after().
+ */
+struct Dependencies
+{
+    std::vector<StepHandle> steps;
+};
+
+/**
+ * Declares the steps a new step depends on when initializing in parallel.
+ * Example: auto buffers = seqraii.addStep(allocFn, freeFn, after());
+ *          seqraii.addStep(registerFn, unregisterFn, after(socket, buffers));
+ */
+template <class... Handles>
+Dependencies after(Handles... handles)
+{
+    return Dependencies{{handles...}};
+}
+
+/**
+ * Name of a step, passed to observers. Must outlive the container, typically a string literal.
+ */
+struct Label
+{
+    const char* name;
+};
+
+/**
+ * Names a new step for observers. Example: seqraii.addStep(bindFn, label("bind"));
+ */
+inline Label label(const char* name) noexcept
+{
+    return Label{name};
+}
+
+/**
+ * Retry policy of a step, see retry(). A step whose initialization fails is retried in place with
+ * exponential backoff, and only once it runs out of attempts or time is the sequence rolled back.
+ */
+struct RetryPolicy
+{
+    /// Total number of attempts, including the first one.
+    unsigned maxAttempts = 1;
+
+    /// Delay before the first retry. Every further delay is multiplier times longer, up to maxBackoff.
+    std::chrono::milliseconds initialBackoff{10};
+    double multiplier = 2.0;
+    std::chrono::milliseconds maxBackoff{1000};
+
+    /// Fraction of each delay that is randomized, from 0 for none to 1 for full jitter.
+    double jitter = 0.5;
+
+    /// Time allowed for retrying after the first failure. Zero for no limit.
+    std::chrono::milliseconds deadline{0};
+};
+
+/**
+ * Retries a new step in place when its initialization fails.
+ * Example: seqraii.addStep(bindFn, retry(5, std::chrono::milliseconds(50)));
+ * @param maxAttempts Total number of attempts, including the first one.
+ * @param initialBackoff Delay before the first retry, doubled for every further retry.
+ * @param deadline Time allowed for retrying after the first failure. Zero for no limit.
+ */
+inline RetryPolicy retry(unsigned maxAttempts,
+                         std::chrono::milliseconds initialBackoff = std::chrono::milliseconds(10),
+                         std::chrono::milliseconds deadline = std::chrono::milliseconds(0)) noexcept
+{
+    RetryPolicy policy;
+    policy.maxAttempts = maxAttempts;
+    policy.initialBackoff = initialBackoff;
+    policy.deadline = deadline;
+    return policy;
+}
+
+/**
+ * Health check of a step, see verify() and SequentialRaii::heal().
+ */
+struct Verify
+{
+    std::shared_ptr<const std::function<bool()>> check;
+};
+
+namespace detail
+{
+/**
+ * True if the check can be called without arguments, rather than with the context of a blueprint
+ * instance.
+ */
+template <class Check, class Void = void>
+struct IsNullaryCheck : std::false_type {};
+
+template <class Check>
+struct IsNullaryCheck<Check, decltype(void(std::declval<Check&>()()))> : std::true_type {};
+
+} // Namespace detail
+
+/**
+ * Gives a new step a cheap check of whether what it initialized still works, e.g. that its
+ * connection is still up. SequentialRaii::heal() initializes the steps again from the first one
+ * failing its check. Checks throwing count as failed. Steps of a SequenceBlueprint take a check of
+ * the instance's context instead, see seqraii_blueprint.h.
+ * Example: seqraii.addStep(connectFn, disconnectFn, verify([&]() {return isConnected(fd);}));
+ */
+template <class Check, class = std::enable_if_t<detail::IsNullaryCheck<std::decay_t<Check>>::value>>
+Verify verify(Check&& check)
+{
+    return Verify{std::make_shared<const std::function<bool()>>(std::forward<Check>(check))};
+}
+
+/**
+ * CPUs a step is initialized on, see affinity() and numaNode(). The initializing thread is bound
+ * to them while the step initializes, so that the memory it first touches is placed on their NUMA
+ * node, and is restored afterwards. No CPUs for wherever the initializing thread runs, also when
+ * the sequence has an affinity of its own. Ignored where threads can't be bound, i.e. anywhere but
+ * Linux.
+ */
+struct Affinity
+{
+    /// As many CPUs as a cpu_set_t holds, so that copying an affinity never allocates.
+    std::bitset<1024> cpus;
+};
+
+/**
+ * Initializes a new step on one of the given CPUs. CPUs beyond the 1024th are ignored.
+ * Example: seqraii.addStep(allocRingFn, freeRingFn, affinity({shard}));
+ */
+inline Affinity affinity(std::initializer_list<unsigned> cpus) noexcept
+{
+    Affinity result;
+    for (const unsigned cpu : cpus)
+    {
+        if (cpu < result.cpus.size())
+        {
+            result.cpus.set(cpu);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Initializes a new step on the CPUs of a NUMA node, as listed in
+ * /sys/devices/system/node/node<N>/cpulist. No CPUs if the node is unknown.
+ */
+inline Affinity numaNode(unsigned node) noexcept
+{
+    Affinity result;
+#if SEQRAII_HAS_AFFINITY
+    char path[64];
+    std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+    std::FILE* file = std::fopen(path, "r");
+    if (!file)
+    {
+        return result;
+    }
+
+    // Comma separated CPUs and ranges of CPUs, e.g. "0-3,8-11".
+    unsigned first;
+    while (std::fscanf(file, "%u", &first) == 1)
+    {
+        unsigned last = first;
+        int separator = std::fgetc(file);
+        if (separator == '-' && std::fscanf(file, "%u", &last) == 1)
+        {
+            separator = std::fgetc(file);
+        }
+
+        for (unsigned cpu = first; cpu <= last && cpu < result.cpus.size(); ++cpu)
+        {
+            result.cpus.set(cpu);
+        }
+
+        if (separator != ',')
+        {
+            break;
+        }
+    }
+
+    std::fclose(file);
+#else
+    (void)node;
+#endif
+    return result;
+}
+
+/**
+ * Splits the items of a range of steps into chunks of the given size, run concurrently on an
+ * executor, see inChunks(). The executor must outlive the sequence.
+ */
+struct Chunks
+{
+    Executor* executor = nullptr;
+    std::size_t size = 0;
+};
+
+/**
+ * Initializes and uninitializes the items of a new range of steps in chunks, on the executor and
+ * the calling thread together. Ignored for other steps.
+ * Example: seqraii.addSteps(10000, openFn, closeFn, inChunks(pool, 256));
+ */
+inline Chunks inChunks(Executor& executor, std::size_t size) noexcept
+{
+    return Chunks{&executor, size};
+}
+
+/**
+ * Step standing for a range of items, initialized in order of their index and uninitialized in
+ * reverse, see SequentialRaii::addSteps().
+ */
+class RangeStepBase : public StepBase
+{
+public:
+    explicit RangeStepBase(std::size_t count) noexcept
+        : m_count(count)
+    {}
+
+    virtual RangeStepBase* asRange() noexcept override
+    {
+        return this;
+    }
+
+    void setChunks(const Chunks& chunks) noexcept
+    {
+        m_chunks = chunks;
+    }
+
+    /**
+     * @return Number of items in the range.
+     */
+    std::size_t count() const noexcept
+    {
+        return m_count;
+    }
+
+protected:
+    /**
+     * @return Number of chunks to split the range into, 1 to run it on the calling thread alone.
+     */
+    std::size_t chunkCount() const noexcept
+    {
+        if (!m_chunks.executor || m_chunks.size == 0 || m_count <= m_chunks.size)
+        {
+            return 1;
+        }
+
+        return (m_count + m_chunks.size - 1) / m_chunks.size;
+    }
+
+    std::size_t m_count;
+    Chunks m_chunks;
+};
+
+/**
+ * Interface for observing initialization and uninitialization of the individual steps, e.g. for
+ * profiling startup. Hooks get the index of the step in the order steps were added, and its label.
+ * Observers passed to the parallel initialize()/uninitialize() are called from the executor's
+ * threads and must be thread-safe.
+ */
+class StepObserver
+{
+public:
+    virtual ~StepObserver() noexcept = default;
+
+    virtual void onInitBegin(std::size_t /*index*/, const char* /*label*/) noexcept {}
+    virtual void onInitEnd(std::size_t /*index*/, const char* /*label*/, bool /*success*/) noexcept {}
+    virtual void onUninitBegin(std::size_t /*index*/, const char* /*label*/) noexcept {}
+    virtual void onUninitEnd(std::size_t /*index*/, const char* /*label*/) noexcept {}
+
+    /**
+     * Called after onInitEnd() for the step whose failure causes the sequence to be rolled back.
+     */
+    virtual void onFailure(std::size_t /*index*/, const char* /*label*/) noexcept {}
+};
+
+/**
+ * Observer doing nothing, used when none is given. Its hooks are not virtual, so calls to them
+ * compile down to nothing.
+ */
+struct NullObserver final
+{
+    void onInitBegin(std::size_t, const char*) noexcept {}
+    void onInitEnd(std::size_t, const char*, bool) noexcept {}
+    void onUninitBegin(std::size_t, const char*) noexcept {}
+    void onUninitEnd(std::size_t, const char*) noexcept {}
+    void onFailure(std::size_t, const char*) noexcept {}
+};
+
+namespace detail
+{
+/**
+ * Tells observers apart from the other arguments initialize() is overloaded for.
+ */
+template <class T>
+using IsObserver = std::integral_constant<bool, !std::is_base_of<Executor, T>::value &&
+    !std::is_same<std::remove_const_t<T>, StopToken>::value &&
+    !std::is_same<std::remove_const_t<T>, StopToken::Clock::time_point>::value>;
+
+} // Namespace detail
+
+/**
+ * Observer recording when each step started and how long it took to initialize and uninitialize,
+ * measured with the monotonic clock. Keeps the timings of the latest run of each step. Thread-safe.
+ */
+class StepTimer final : public StepObserver
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Timing
+    {
+        const char* label = nullptr;
+        Clock::time_point initBegin;
+        Clock::duration initDuration{0};
+        Clock::time_point uninitBegin;
+        Clock::duration uninitDuration{0};
+        std::thread::id initThread;
+        std::thread::id uninitThread;
+        bool initialized = false;
+        bool failed = false;
+    };
+
+    /**
+     * @param expectedSteps Number of steps to reserve room for, so recording does not allocate.
+     */
+    explicit StepTimer(std::size_t expectedSteps = 0)
+    {
+        m_timings.reserve(expectedSteps);
+    }
+
+    /**
+     * @return Timings indexed by step. Must not be called while a run is in progress.
+     */
+    const std::vector<Timing>& timings() const noexcept
+    {
+        return m_timings;
+    }
+
+    void clear() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_timings.clear();
+    }
+
+    virtual void onInitBegin(std::size_t index, const char* label) noexcept override
+    {
+        const auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (Timing* timing = at(index))
+        {
+            *timing = Timing{};
+            timing->label = label;
+            timing->initBegin = now;
+            timing->initThread = std::this_thread::get_id();
+        }
+    }
+
+    virtual void onInitEnd(std::size_t index, const char*, bool success) noexcept override
+    {
+        const auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (Timing* timing = at(index))
+        {
+            timing->initDuration = now - timing->initBegin;
+            timing->initialized = success;
+        }
+    }
+
+    virtual void onUninitBegin(std::size_t index, const char* label) noexcept override
+    {
+        const auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (Timing* timing = at(index))
+        {
+            timing->label = label;
+            timing->uninitBegin = now;
+            timing->uninitThread = std::this_thread::get_id();
+        }
+    }
+
+    virtual void onUninitEnd(std::size_t index, const char*) noexcept override
+    {
+        const auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (Timing* timing = at(index))
+        {
+            timing->uninitDuration = now - timing->uninitBegin;
+            timing->initialized = false;
+        }
+    }
+
+    virtual void onFailure(std::size_t index, const char*) noexcept override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (Timing* timing = at(index))
+        {
+            timing->failed = true;
+        }
+    }
+
+private:
+    /**
+     * @return Timing of the given step, or null if there was no memory to record it.
+     */
+    Timing* at(std::size_t index) noexcept
+    {
+        SEQRAII_TRY
+        {
+            if (index >= m_timings.size())
+            {
+                m_timings.resize(index + 1);
+            }
+        }
+        SEQRAII_CATCH_ALL
+        {
+            return nullptr;
+        }
+
+        return &m_timings[index];
+    }
+
+    std::vector<Timing> m_timings;
+    std::mutex m_mutex;
+};
+
+namespace detail
+{
+/**
+ * Tells the options that may follow the lambdas in SequentialRaii::addStep() from the lambdas.
+ */
+template <class T> struct IsStepOption : std::false_type {};
+template <> struct IsStepOption<Dependencies> : std::true_type {};
+template <> struct IsStepOption<Label> : std::true_type {};
+template <> struct IsStepOption<RetryPolicy> : std::true_type {};
+template <> struct IsStepOption<Affinity> : std::true_type {};
+template <> struct IsStepOption<Chunks> : std::true_type {};
+template <> struct IsStepOption<Verify> : std::true_type {};
+
+template <class... T> struct AreStepOptions : std::true_type {};
+template <class T, class... Rest> struct AreStepOptions<T, Rest...>
+    : std::integral_constant<bool, IsStepOption<std::decay_t<T>>::value && AreStepOptions<Rest...>::value> {};
+
+/**
+ * Storage for the type-erased steps of a SequentialRaii. Steps are placed one after another in a
+ * monotonic buffer: inline in the container as long as they fit, then in chunks taken from the
+ * memory resource. A separate index of step pointers keeps the order they were added in. Nothing
+ * is released before the whole storage is cleared.
+ */
+class StepStorage
+{
+public:
+    /// Number of step pointers kept inline before the index moves to allocated memory.
+    static constexpr std::size_t kInlineSteps = 8;
+
+    /// Bytes of inline storage for the steps themselves.
+    static constexpr std::size_t kInlineBytes = 384;
+
+    /// Smallest chunk allocated once the inline storage is exhausted.
+    static constexpr std::size_t kMinChunkBytes = 1024;
+
+#if SEQRAII_HAS_MEMORY_RESOURCE
+    explicit StepStorage(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept
+        : m_resource(resource)
+    {}
+#else
+    StepStorage() noexcept = default;
+#endif
+
+    ~StepStorage() noexcept
+    {
+        clear();
+    }
+
+    StepStorage(const StepStorage&) = delete;
+    StepStorage& operator=(const StepStorage&) = delete;
+
+    StepStorage(StepStorage&& rhs) noexcept
+    {
+        takeFrom(rhs);
+    }
+
+    StepStorage& operator=(StepStorage&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            clear();
+            takeFrom(rhs);
+        }
+
+        return *this;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    StepBase* operator[](std::size_t index) const noexcept
+    {
+        return m_index[index];
+    }
+
+    /**
+     * Makes room for a number of additional steps, so that adding them does not allocate.
+     * @param steps Number of steps to make room for.
+     * @param bytesPerStep Expected size of each step.
+     */
+    void reserve(std::size_t steps, std::size_t bytesPerStep)
+    {
+        reserveIndex(m_size + steps);
+
+        const std::size_t available = (kInlineBytes - m_inlineUsed) + (m_chunks ? m_chunks->capacity - m_chunks->used : 0);
+        if (steps * bytesPerStep > available)
+        {
+            addChunk(steps * bytesPerStep);
+        }
+    }
+
+    /**
+     * Constructs a step of type T at the end of the storage.
+     */
+    template <class T, class... Args>
+    T* emplace(Args&&... args)
+    {
+        reserveIndex(m_size + 1);
+
+        // Only steps that can be moved without throwing may live inline, since inline steps
+        // have to be relocated when the container is moved.
+        void* memory = allocate(sizeof(T), alignof(T), std::is_nothrow_move_constructible<T>::value);
+        T* step = new (memory) T(std::forward<Args>(args)...);
+        m_index[m_size++] = step;
+        return step;
+    }
+
+    /**
+     * Destroys all steps and releases all memory.
+     */
+    void clear() noexcept
+    {
+        for (std::size_t i = 0; i < m_size; ++i)
+        {
+            m_index[i]->~StepBase();
+        }
+
+        while (m_chunks)
+        {
+            Chunk* next = m_chunks->next;
+            deallocateBlock(m_chunks, sizeof(Chunk) + m_chunks->capacity, alignof(Chunk));
+            m_chunks = next;
+        }
+
+        if (m_index != m_inlineIndex)
+        {
+            deallocateBlock(m_index, m_capacity * sizeof(StepBase*), alignof(StepBase*));
+        }
+
+        m_index = m_inlineIndex;
+        m_size = 0;
+        m_capacity = kInlineSteps;
+        m_inlineUsed = 0;
+    }
+
+private:
+    /// Header of an allocated chunk, the chunk's bytes follow directly after.
+    struct alignas(std::max_align_t) Chunk
+    {
+        Chunk* next;
+        std::size_t capacity;
+        std::size_t used;
+    };
+
+    static unsigned char* data(Chunk* chunk) noexcept
+    {
+        return reinterpret_cast<unsigned char*>(chunk + 1);
+    }
+
+    static void* bump(unsigned char* base, std::size_t capacity, std::size_t& used, std::size_t size, std::size_t alignment) noexcept
+    {
+        void* memory = base + used;
+        std::size_t space = capacity - used;
+        if (!std::align(alignment, size, memory, space))
+        {
+            return nullptr;
+        }
+
+        used = static_cast<std::size_t>(static_cast<unsigned char*>(memory) - base) + size;
+        return memory;
+    }
+
+    bool isInline(const void* memory) const noexcept
+    {
+        std::less<const void*> less;
+        return !less(memory, m_inlineBytes) && less(memory, m_inlineBytes + kInlineBytes);
+    }
+
+    void* allocate(std::size_t size, std::size_t alignment, bool allowInline)
+    {
+        // Inline steps are kept a prefix of the index, so moving only has to look at the front.
+        void* memory = nullptr;
+        if (allowInline && !m_chunks)
+        {
+            memory = bump(m_inlineBytes, kInlineBytes, m_inlineUsed, size, alignment);
+        }
+
+        if (!memory && m_chunks)
+        {
+            memory = bump(data(m_chunks), m_chunks->capacity, m_chunks->used, size, alignment);
+        }
+
+        if (!memory)
+        {
+            addChunk(size + alignment);
+            memory = bump(data(m_chunks), m_chunks->capacity, m_chunks->used, size, alignment);
+        }
+
+        return memory;
+    }
+
+    void addChunk(std::size_t minBytes)
+    {
+        // Grow geometrically to keep the number of allocations logarithmic in the step count.
+        std::size_t capacity = minBytes > kMinChunkBytes ? minBytes : kMinChunkBytes;
+        if (m_chunks)
+        {
+            capacity = std::max(capacity, 2 * m_chunks->capacity);
+        }
+
+        Chunk* chunk = static_cast<Chunk*>(allocateBlock(sizeof(Chunk) + capacity, alignof(Chunk)));
+        chunk->next = m_chunks;
+        chunk->capacity = capacity;
+        chunk->used = 0;
+        m_chunks = chunk;
+    }
+
+    void reserveIndex(std::size_t capacity)
+    {
+        if (capacity <= m_capacity)
+        {
+            return;
+        }
+
+        capacity = std::max(capacity, 2 * m_capacity);
+        StepBase** index = static_cast<StepBase**>(allocateBlock(capacity * sizeof(StepBase*), alignof(StepBase*)));
+        std::copy(m_index, m_index + m_size, index);
+
+        if (m_index != m_inlineIndex)
+        {
+            deallocateBlock(m_index, m_capacity * sizeof(StepBase*), alignof(StepBase*));
+        }
+
+        m_index = index;
+        m_capacity = capacity;
+    }
+
+    void* allocateBlock(std::size_t bytes, std::size_t alignment)
+    {
+#if SEQRAII_HAS_MEMORY_RESOURCE
+        return m_resource->allocate(bytes, alignment);
+#else
+        (void)alignment;
+        return ::operator new(bytes);
+#endif
+    }
+
+    void deallocateBlock(void* memory, std::size_t bytes, std::size_t alignment) noexcept
+    {
+#if SEQRAII_HAS_MEMORY_RESOURCE
+        m_resource->deallocate(memory, bytes, alignment);
+#else
+        (void)bytes;
+        (void)alignment;
+        ::operator delete(memory);
+#endif
+    }
+
+    void takeFrom(StepStorage& rhs) noexcept
+    {
+#if SEQRAII_HAS_MEMORY_RESOURCE
+        m_resource = rhs.m_resource;
+#endif
+        m_chunks = rhs.m_chunks;
+        m_size = rhs.m_size;
+        m_capacity = rhs.m_capacity;
+        m_inlineUsed = rhs.m_inlineUsed;
+
+        if (rhs.m_index == rhs.m_inlineIndex)
+        {
+            m_index = m_inlineIndex;
+            std::copy(rhs.m_inlineIndex, rhs.m_inlineIndex + m_size, m_inlineIndex);
+        }
+        else
+        {
+            m_index = rhs.m_index;
+        }
+
+        // Chunks change owner as they are, inline steps must be moved over.
+        for (std::size_t i = 0; i < m_size && rhs.isInline(m_index[i]); ++i)
+        {
+            m_index[i] = m_index[i]->relocate(rhs.m_inlineBytes, m_inlineBytes);
+        }
+
+        rhs.m_chunks = nullptr;
+        rhs.m_index = rhs.m_inlineIndex;
+        rhs.m_size = 0;
+        rhs.m_capacity = kInlineSteps;
+        rhs.m_inlineUsed = 0;
+    }
+
+#if SEQRAII_HAS_MEMORY_RESOURCE
+    std::pmr::memory_resource* m_resource;
+#endif
+
+    StepBase** m_index = m_inlineIndex;
+    std::size_t m_size = 0;
+    std::size_t m_capacity = kInlineSteps;
+    StepBase* m_inlineIndex[kInlineSteps];
+
+    Chunk* m_chunks = nullptr;
+    std::size_t m_inlineUsed = 0;
+    alignas(std::max_align_t) unsigned char m_inlineBytes[kInlineBytes];
+};
+
+/**
+ * Moves a step into new storage, see StepBase::relocate(). Steps that may throw while being moved
+ * are never placed inline, so the fallback is unreachable.
+ */
+template <class T>
+StepBase* relocate(T* step, unsigned char* oldBase, unsigned char* newBase, std::true_type) noexcept
+{
+    void* memory = newBase + (reinterpret_cast<unsigned char*>(step) - oldBase);
+    T* moved = new (memory) T(std::move(*step));
+    step->~T();
+    return moved;
+}
+
+template <class T>
+StepBase* relocate(T*, unsigned char*, unsigned char*, std::false_type) noexcept
+{
+    std::terminate();
+}
+
+/// Retry policies of the steps having one, as (step, policy) pairs ordered by step.
+using RetryPolicies = std::vector<std::pair<std::size_t, RetryPolicy>>;
+
+/**
+ * Retries a failed step according to its policy.
+ * @return True if one of the retries succeeded.
+ */
+inline bool retryInit(StepBase& step, const RetryPolicy& policy, InitResult* result, const StopToken* stop) noexcept
+{
+    using Clock = std::chrono::steady_clock;
+    using Delay = std::chrono::duration<double, std::micro>;
+
+    const auto deadline = Clock::now() + policy.deadline;
+    std::minstd_rand random(static_cast<std::minstd_rand::result_type>(Clock::now().time_since_epoch().count()));
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    Delay backoff = policy.initialBackoff;
+    for (unsigned attempt = 1; attempt < policy.maxAttempts; ++attempt)
+    {
+        const auto delay = std::chrono::duration_cast<Clock::duration>(backoff * (1.0 - policy.jitter * unit(random)));
+        if (policy.deadline.count() > 0 && Clock::now() + delay > deadline)
+        {
+            return false;
+        }
+
+        // Retries end with the stop token's deadline too.
+        if (stop && (stop->stopRequested() || Clock::now() + delay > stop->deadline()))
+        {
+            return false;
+        }
+
+        std::this_thread::sleep_for(delay);
+        if (result)
+        {
+            *result = InitResult{};
+        }
+
+        if (step.init(result, stop))
+        {
+            return true;
+        }
+
+        backoff = std::min(backoff * policy.multiplier, Delay(policy.maxBackoff));
+    }
+
+    return false;
+}
+
+/// Health checks of the steps having one, as (step, check) pairs ordered by step.
+using Verifiers = std::vector<std::pair<std::size_t, std::shared_ptr<const std::function<bool()>>>>;
+
+/// Affinities of the steps having one, as (step, affinity) pairs ordered by step.
+using Affinities = std::vector<std::pair<std::size_t, Affinity>>;
+
+/**
+ * @return True if any step may have to be bound, false if none is, which spares looking each one up.
+ */
+inline bool hasAffinity(const Affinities& affinities, const Affinity& fallback) noexcept
+{
+    return !affinities.empty() || fallback.cpus.any();
+}
+
+/**
+ * @return Affinity the step was added with, else the fallback. Null if there are no CPUs to bind to.
+ */
+inline const Affinity* findAffinity(const Affinities& affinities, const Affinity& fallback, std::size_t index) noexcept
+{
+    auto it = std::lower_bound(affinities.begin(), affinities.end(), index,
+        [](const std::pair<std::size_t, Affinity>& entry, std::size_t i) {return entry.first < i;});
+
+    const Affinity& affinity = (it != affinities.end() && it->first == index) ? it->second : fallback;
+    return affinity.cpus.none() ? nullptr : &affinity;
+}
+
+/**
+ * Binds the calling thread to the CPUs of an affinity for as long as it exists, then restores the
+ * CPUs it was allowed to run on before.
+ */
+class AffinityScope
+{
+public:
+    explicit AffinityScope(const Affinity* affinity) noexcept
+    {
+#if SEQRAII_HAS_AFFINITY
+        if (!affinity)
+        {
+            return;
+        }
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (std::size_t cpu = 0; cpu < affinity->cpus.size() && cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (affinity->cpus[cpu])
+            {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+
+        if (sched_getaffinity(0, sizeof(m_previous), &m_previous) != 0)
+        {
+            m_error = errno;
+        }
+        else if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+        {
+            m_error = errno;
+        }
+        else
+        {
+            m_bound = true;
+        }
+#else
+        (void)affinity;
+#endif
+    }
+
+    ~AffinityScope() noexcept
+    {
+#if SEQRAII_HAS_AFFINITY
+        if (m_bound)
+        {
+            sched_setaffinity(0, sizeof(m_previous), &m_previous);
+        }
+#endif
+    }
+
+    AffinityScope(const AffinityScope&) = delete;
+    AffinityScope& operator=(const AffinityScope&) = delete;
+
+    /// Errno of binding the thread, 0 if it is bound or didn't have to be.
+    int error() const noexcept
+    {
+        return m_error;
+    }
+
+private:
+#if SEQRAII_HAS_AFFINITY
+    cpu_set_t m_previous;
+    bool m_bound = false;
+#endif
+    int m_error = 0;
+};
+
+/**
+ * Handles a failed first attempt of a step: retries it as long as its retry policy allows, else
+ * reports it failed. The policy is only looked up here, so steps that succeed right away don't pay
+ * for it.
+ */
+inline bool retryStep(StepBase& step, std::size_t index, const RetryPolicies& policies, InitResult* result,
+                      const StopToken* stop) noexcept
+{
+    auto it = std::lower_bound(policies.begin(), policies.end(), index,
+        [](const std::pair<std::size_t, RetryPolicy>& entry, std::size_t i) {return entry.first < i;});
+
+    if (it != policies.end() && it->first == index && retryInit(step, it->second, result, stop))
+    {
+        return true;
+    }
+
+    if (result)
+    {
+        result->failedStep = index;
+        result->label = step.label();
+    }
+
+    return false;
+}
+
+/**
+ * Runs the initialization of a step like initStep(), with the calling thread bound to the CPUs of
+ * an affinity for all attempts. Failing to bind fails the step.
+ */
+inline bool initStepBound(StepBase& step, std::size_t index, const RetryPolicies& policies, InitResult* result,
+                          const StopToken* stop, const Affinity& affinity) noexcept
+{
+    AffinityScope scope(&affinity);
+    if (scope.error() != 0)
+    {
+        if (result)
+        {
+            result->failedStep = index;
+            result->label = step.label();
+            result->error = std::error_code(scope.error(), std::system_category());
+        }
+
+        return false;
+    }
+
+    return step.init(result, stop) || retryStep(step, index, policies, result, stop);
+}
+
+/**
+ * Runs the initialization of a step, retrying it as long as its retry policy allows. With an
+ * affinity, all attempts run on its CPUs. Kept small, so that it inlines into the loops calling it
+ * and steps without an affinity or a failure only pay for the call of their init().
+ */
+inline bool initStep(StepBase& step, std::size_t index, const RetryPolicies& policies, InitResult* result,
+                     const StopToken* stop = nullptr, const Affinity* affinity = nullptr) noexcept
+{
+    if (affinity)
+    {
+        return initStepBound(step, index, policies, result, stop, *affinity);
+    }
+
+    return step.init(result, stop) || retryStep(step, index, policies, result, stop);
+}
+
+/**
+ * Turns what an initialization lambda returned into success or failure. Lambdas return either
+ * bool or std::error_code, where an empty error code means success. Without an error code errno
+ * is recorded, which the step is expected to leave set on failure.
+ */
+inline bool toSuccess(bool success, InitResult* result) noexcept
+{
+    if (!success && result && errno != 0)
+    {
+        result->error = std::error_code(errno, std::system_category());
+    }
+
+    return success;
+}
+
+inline bool toSuccess(const std::error_code& error, InitResult* result) noexcept
+{
+    if (error && result)
+    {
+        result->error = error;
+    }
+
+    return !error;
+}
+
+/**
+ * True if the initialization lambda takes a StopToken after the given arguments.
+ */
+template <class Init, class Void, class... Args>
+struct TakesStopTokenImpl : std::false_type {};
+
+template <class Init, class... Args>
+struct TakesStopTokenImpl<Init, decltype(void(std::declval<Init&>()(std::declval<Args&>()..., std::declval<const StopToken&>()))), Args...>
+    : std::true_type {};
+
+template <class Init, class... Args>
+using TakesStopToken = TakesStopTokenImpl<Init, void, Args...>;
+
+/**
+ * True if calling the initialization lambda with the given arguments and converting its result
+ * can't throw, or if exceptions are disabled.
+ */
+template <class Init, class... Args>
+using IsNothrowInit = std::integral_constant<bool, !SEQRAII_HAS_EXCEPTIONS ||
+    noexcept(toSuccess(std::declval<Init&>()(std::declval<Args&>()...), nullptr))>;
+
+template <class Uninit, class... Args>
+using IsNothrowUninit = std::integral_constant<bool, !SEQRAII_HAS_EXCEPTIONS ||
+    noexcept(std::declval<Uninit&>()(std::declval<Args&>()...))>;
+
+template <class Init, class... Args>
+bool runInit(std::true_type, Init& init, InitResult* result, Args&... args) noexcept
+{
+    return toSuccess(init(args...), result);
+}
+
+template <class Init, class... Args>
+bool runInit(std::false_type, Init& init, InitResult* result, Args&... args) noexcept
+{
+    SEQRAII_TRY
+    {
+        return toSuccess(init(args...), result);
+    }
+    SEQRAII_CATCH_ALL
+    {
+        if (result)
+        {
+            result->exception = std::current_exception();
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Runs an initialization lambda, turning what it returned or threw into success or failure. The
+ * exception handler is only compiled in for lambdas that may throw.
+ */
+template <class Init, class... Args>
+bool runInit(Init& init, InitResult* result, Args&... args) noexcept
+{
+    return runInit(IsNothrowInit<Init, Args...>{}, init, result, args...);
+}
+
+/**
+ * Runs an initialization lambda like runInit(), passing it the stop token if it takes one. Without
+ * a token it gets one that never stops.
+ */
+template <class Init, class... Args>
+bool runStoppableInit(std::true_type, Init& init, InitResult* result, const StopToken* stop, Args&... args) noexcept
+{
+    const StopToken never;
+    const StopToken& token = stop ? *stop : never;
+    return runInit(init, result, args..., token);
+}
+
+template <class Init, class... Args>
+bool runStoppableInit(std::false_type, Init& init, InitResult* result, const StopToken*, Args&... args) noexcept
+{
+    return runInit(init, result, args...);
+}
+
+template <class Init, class... Args>
+bool runStoppableInit(Init& init, InitResult* result, const StopToken* stop, Args&... args) noexcept
+{
+    return runStoppableInit(TakesStopToken<Init, Args...>{}, init, result, stop, args...);
+}
+
+template <class Uninit, class... Args>
+void runUninit(std::true_type, Uninit& uninit, Args&... args) noexcept
+{
+    uninit(args...);
+}
+
+template <class Uninit, class... Args>
+void runUninit(std::false_type, Uninit& uninit, Args&... args) noexcept
+{
+    SEQRAII_TRY
+    {
+        uninit(args...);
+    }
+    SEQRAII_CATCH_ALL
+    {
+    }
+}
+
+/**
+ * Runs an uninitialization lambda, swallowing what it throws unless it is noexcept.
+ */
+template <class Uninit, class... Args>
+void runUninit(Uninit& uninit, Args&... args) noexcept
+{
+    runUninit(IsNothrowUninit<Uninit, Args...>{}, uninit, args...);
+}
+
+/**
+ * State of one parallel initialization or uninitialization run. Holds the dependency graph in
+ * compressed form together with the bookkeeping of which steps are ready, running and completed.
+ * Everything is allocated up front, the run itself does not allocate.
+ */
+struct ParallelRun
+{
+    /// Dependency value marking a step declared without dependencies.
+    static constexpr std::size_t kNoStep = static_cast<std::size_t>(-1);
+
+    /**
+     * Builds the graph for a run over the steps from begin_ up to stepCount. Steps before begin_
+     * are already initialized, so the steps depending on them only wait for the others.
+     * @param uninit When set the edges are reversed: a step is uninitialized once all steps
+     *               depending on it have been uninitialized.
+     */
+    ParallelRun(const std::vector<std::pair<std::size_t, std::size_t>>& dependencies, std::size_t begin_, std::size_t stepCount, bool uninit_)
+        : begin(begin_)
+        , uninit(uninit_)
+        , remaining(stepCount, 0)
+        , dependentsBegin(stepCount + 1, 0)
+        , completed(stepCount, 0)
+        , ready(stepCount, 0)
+    {
+        // Steps without explicitly declared dependencies depend on the previous step.
+        std::vector<std::pair<std::size_t, std::size_t>> edges;
+        std::vector<char> isExplicit(stepCount, 0);
+        for (const auto& dependency : dependencies)
+        {
+            if (dependency.first >= stepCount)
+            {
+                break;
+            }
+
+            isExplicit[dependency.first] = 1;
+            if (dependency.second != kNoStep)
+            {
+                edges.emplace_back(dependency.second, dependency.first);
+            }
+        }
+
+        for (std::size_t i = 1; i < stepCount; ++i)
+        {
+            if (!isExplicit[i])
+            {
+                edges.emplace_back(i - 1, i);
+            }
+        }
+
+        // Dependencies always point backwards, so this drops every edge leaving the done steps.
+        edges.erase(std::remove_if(edges.begin(), edges.end(), [this](const std::pair<std::size_t, std::size_t>& edge) {return edge.first < begin;}), edges.end());
+        std::fill(completed.begin(), completed.begin() + begin, 1);
+
+        if (uninit)
+        {
+            for (auto& edge : edges)
+            {
+                std::swap(edge.first, edge.second);
+            }
+        }
+
+        // Build the dependents lists, grouped per step.
+        for (const auto& edge : edges)
+        {
+            ++dependentsBegin[edge.first + 1];
+            ++remaining[edge.second];
+        }
+
+        for (std::size_t i = 0; i < stepCount; ++i)
+        {
+            dependentsBegin[i + 1] += dependentsBegin[i];
+        }
+
+        dependents.resize(edges.size());
+        std::vector<std::size_t> position(dependentsBegin.begin(), dependentsBegin.end() - 1);
+        for (const auto& edge : edges)
+        {
+            dependents[position[edge.first]++] = edge.second;
+        }
+    }
+
+    /**
+     * Runs all steps and blocks until the run is finished or has failed and gone quiet.
+     */
+    void start(const StepStorage& steps_, const RetryPolicies& retryPolicies_, const Affinities& affinities_,
+               const Affinity& affinity_, Executor& executor, StepObserver* observer_, InitResult* result_)
+    {
+        steps = &steps_;
+        retryPolicies = &retryPolicies_;
+        affinities = hasAffinity(affinities_, affinity_) ? &affinities_ : nullptr;
+        affinity = &affinity_;
+        observer = observer_;
+        result = result_;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::size_t i = begin; i < remaining.size(); ++i)
+            {
+                if (remaining[i] == 0)
+                {
+                    ready[readyEnd++] = i;
+                }
+            }
+        }
+
+        dispatch(executor);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() {return inFlight == 0 && (failed || readyBegin == readyEnd);});
+    }
+
+    /**
+     * Hands all ready steps to the executor, or drops them once the run has failed.
+     */
+    void dispatch(Executor& executor)
+    {
+        while (true)
+        {
+            std::size_t index;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (failed || readyBegin == readyEnd)
+                {
+                    return;
+                }
+
+                index = ready[readyBegin++];
+                ++inFlight;
+            }
+
+            SEQRAII_TRY
+            {
+                executor.execute([this, &executor, index]() {runStep(executor, index);});
+            }
+            SEQRAII_CATCH_ALL
+            {
+                if (uninit)
+                {
+                    // Cleanup must happen regardless, do it on this thread instead.
+                    runStep(executor, index);
+                    continue;
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (result && !failed)
+                {
+                    result->failedStep = index;
+                    result->label = (*steps)[index]->label();
+                    result->error = std::make_error_code(std::errc::resource_unavailable_try_again);
+                }
+
+                failed = true;
+                --inFlight;
+                idle.notify_all();
+                return;
+            }
+        }
+    }
+
+    void runStep(Executor& executor, std::size_t index)
+    {
+        StepBase* step = (*steps)[index];
+        InitResult stepResult;
+        bool success = true;
+        if (uninit)
+        {
+            if (observer)
+            {
+                observer->onUninitBegin(index, step->label());
+            }
+
+            step->uninit();
+
+            if (observer)
+            {
+                observer->onUninitEnd(index, step->label());
+            }
+        }
+        else
+        {
+            if (observer)
+            {
+                observer->onInitBegin(index, step->label());
+            }
+
+            success = initStep(*step, index, *retryPolicies, result ? &stepResult : nullptr, nullptr,
+                               affinities ? findAffinity(*affinities, *affinity, index) : nullptr);
+
+            if (observer)
+            {
+                observer->onInitEnd(index, step->label(), success);
+                if (!success)
+                {
+                    observer->onFailure(index, step->label());
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (success)
+            {
+                completed[index] = 1;
+                for (std::size_t i = dependentsBegin[index]; i < dependentsBegin[index + 1]; ++i)
+                {
+                    if (--remaining[dependents[i]] == 0)
+                    {
+                        ready[readyEnd++] = dependents[i];
+                    }
+                }
+            }
+            else
+            {
+                // Report the first failure only.
+                if (result && !failed)
+                {
+                    *result = std::move(stepResult);
+                }
+
+                failed = true;
+            }
+        }
+
+        dispatch(executor);
+
+        // Only leave the in-flight count after dispatching, so the run never looks finished early.
+        std::lock_guard<std::mutex> lock(mutex);
+        --inFlight;
+        idle.notify_all();
+    }
+
+    const StepStorage* steps = nullptr;
+    const RetryPolicies* retryPolicies = nullptr;
+    const Affinities* affinities = nullptr;
+    const Affinity* affinity = nullptr;
+    StepObserver* observer = nullptr;
+    InitResult* result = nullptr;
+    const std::size_t begin;
+    const bool uninit;
+
+    /// Number of dependencies left per step, or dependents when uninitializing.
+    std::vector<std::size_t> remaining;
+
+    /// Dependents of step i are dependents[dependentsBegin[i]] to dependents[dependentsBegin[i + 1]],
+    /// or the steps it depends on when uninitializing.
+    std::vector<std::size_t> dependentsBegin;
+    std::vector<std::size_t> dependents;
+
+    /// Flags for steps that were initialized successfully.
+    std::vector<char> completed;
+
+    /// Queue of steps whose dependencies are all initialized.
+    std::vector<std::size_t> ready;
+    std::size_t readyBegin = 0;
+    std::size_t readyEnd = 0;
+
+    std::size_t inFlight = 0;
+    bool failed = false;
+
+    std::mutex mutex;
+    std::condition_variable idle;
+};
+
+/**
+ * State of one run over the chunks of a range of steps, shared with the executor's tasks. Tasks
+ * starting once all chunks have been claimed leave without touching the step, so a run may end
+ * before every task it handed out has started.
+ */
+struct ChunkRun
+{
+    explicit ChunkRun(std::size_t chunks_)
+        : chunks(chunks_)
+        , completed(chunks_, 0)
+    {}
+
+    const std::size_t chunks;
+    std::atomic<std::size_t> next{0};
+
+    /// Set when a chunk fails or is stopped, telling the others to stop too.
+    std::atomic<bool> failed{false};
+
+    /// Items initialized per chunk, each written by the thread running that chunk.
+    std::vector<std::size_t> completed;
+
+    /// Number of chunks done, and the first failure. Guarded by mutex.
+    std::size_t finished = 0;
+    InitResult result;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+/**
+ * Runs work(run, chunk) for every chunk, on the executor and the calling thread, and blocks until
+ * all chunks are done. The calling thread keeps claiming chunks itself, so the run completes even
+ * if the executor is busy with the caller's own task.
+ */
+template <class Work>
+void runChunks(Executor& executor, const std::shared_ptr<ChunkRun>& run, const Work& work) noexcept
+{
+    auto drain = [run, work]()
+    {
+        for (std::size_t chunk = run->next++; chunk < run->chunks; chunk = run->next++)
+        {
+            work(*run, chunk);
+
+            std::lock_guard<std::mutex> lock(run->mutex);
+            if (++run->finished == run->chunks)
+            {
+                run->done.notify_all();
+            }
+        }
+    };
+
+    for (std::size_t i = 1; i < run->chunks; ++i)
+    {
+        SEQRAII_TRY
+        {
+            executor.execute(drain);
+        }
+        SEQRAII_CATCH_ALL
+        {
+            // The calling thread takes over what the executor couldn't.
+            break;
+        }
+    }
+
+    drain();
+
+    std::unique_lock<std::mutex> lock(run->mutex);
+    run->done.wait(lock, [&run]() {return run->finished == run->chunks;});
+}
+
+} // Namespace detail
+
+/**
+ * Container class for sequential raii steps.
+ */
+class SequentialRaii
+{
+public:
+    /**
+     * Constructs a container for sequential initialization.
+     */
+    SequentialRaii() noexcept
+        : m_steps()
+    {}
+
+#if SEQRAII_HAS_MEMORY_RESOURCE
+    /**
+     * Constructs a container for sequential initialization drawing step storage beyond the
+     * inline buffer from the given memory resource.
+     */
+    explicit SequentialRaii(std::pmr::memory_resource* resource) noexcept
+        : m_steps(resource)
+    {}
+#endif
+
+    /**
+     * Add that feeling of RAII by always cleaning up after us.
+     */
+    ~SequentialRaii() noexcept
+    {
+        if (m_reaper)
+        {
+            retireAsync(*m_reaper);
+        }
+        else
+        {
+            uninitialize();
+        }
+    }
+
+    // Disable copy constructor and copy-assignment operator.
+    SequentialRaii(const SequentialRaii&) = delete;
+    SequentialRaii& operator=(const SequentialRaii&) = delete;
+
+    // Enable move-semantics.
+    SequentialRaii(SequentialRaii&& rhs) noexcept
+        : m_steps(std::move(rhs.m_steps))
+        , m_dependencies(std::move(rhs.m_dependencies))
+        , m_retryPolicies(std::move(rhs.m_retryPolicies))
+        , m_affinities(std::move(rhs.m_affinities))
+        , m_affinity(std::move(rhs.m_affinity))
+        , m_verifiers(std::move(rhs.m_verifiers))
+        , m_initializedCount(rhs.m_initializedCount)
+        , m_reaper(rhs.m_reaper)
+    {
+        rhs.m_initializedCount = 0;
+    }
+
+    /**
+     * Uninitializes this sequence before taking over the steps of rhs, so whatever it brought up
+     * is gone until rhs is initialized. HotSwap in seqraii_hotswap.h replaces without that gap.
+     */
+    SequentialRaii& operator=(SequentialRaii&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            uninitialize();
+            m_steps = std::move(rhs.m_steps);
+            m_dependencies = std::move(rhs.m_dependencies);
+            m_retryPolicies = std::move(rhs.m_retryPolicies);
+            m_affinities = std::move(rhs.m_affinities);
+            m_affinity = std::move(rhs.m_affinity);
+            m_verifiers = std::move(rhs.m_verifiers);
+            m_initializedCount = rhs.m_initializedCount;
+            m_reaper = rhs.m_reaper;
+            rhs.m_initializedCount = 0;
+        }
+
+        return *this;
+    }
+
+    /**
+     * Makes room for a number of steps so that adding them costs no further allocations.
+     * @param steps Number of steps about to be added.
+     * @param bytesPerStep Expected size of each step, i.e. of its captures.
+     */
+    void reserve(std::size_t steps, std::size_t bytesPerStep = 64)
+    {
+        m_steps.reserve(steps, bytesPerStep);
+    }
+
+    /**
+     * Adds a step to the initialization queue. Call initialize() to run any queued steps.
+     * @param init Initialization lambda. Must return true on success, false or throw otherwise.
+     * @param uninit Uninitialization lambda, can be omitted. Will be executed if the initialization
+     *               lambda was successfully run.
+     * @param options Any of:
+     *                - after(steps...): Steps this step depends on. When initializing in parallel
+     *                  the step may run as soon as its dependencies are initialized. Steps added
+     *                  without dependencies depend on the step added right before them, so
+     *                  sequences keep running in order unless told otherwise. The steps must
+     *                  already have been added to this container.
+     *                - label(name): Name of the step passed to observers.
+     *                - retry(attempts, ...): Retry policy of the step, see RetryPolicy. Ignored
+     *                  for asynchronous steps.
+     *                - affinity(cpus), numaNode(node): CPUs to initialize the step on, instead of
+     *                  those set with setAffinity(). Ignored for asynchronous steps.
+     *                - verify(check): Health check of the initialized step, see heal().
+     * @return Handle to the step, for declaring dependencies on it.
+     */
+    template <class Init, class Uninit, class... Options,
+              class = std::enable_if_t<!detail::IsStepOption<std::decay_t<Uninit>>::value>>
+    StepHandle addStep(Init&& init, Uninit&& uninit, const Options&... options)
+    {
+        return emplaceStep<Step<Init, Uninit>>(std::forward<Init>(init), std::forward<Uninit>(uninit), options...);
+    }
+
+    template <class Init, class... Options, class = std::enable_if_t<detail::AreStepOptions<Options...>::value>>
+    StepHandle addStep(Init&& init, const Options&... options)
+    {
+        return addStep(std::forward<Init>(init), [](){}, options...);
+    }
+
+    /**
+     * Adds a step that initialize() only registers. Its initialization lambda runs the first time
+     * the returned handle is acquired, exactly once even when several threads acquire it at the
+     * same time. A failed initialization is attempted again by the next acquire(). Once it ran the
+     * step is uninitialized in its place in the sequence like any other step. Takes the same
+     * options as addStep(), except that retry() and affinity() have no effect.
+     * @return Handle for acquiring the step, also usable with after().
+     */
+    template <class Init, class Uninit, class... Options,
+              class = std::enable_if_t<!detail::IsStepOption<std::decay_t<Uninit>>::value>>
+    LazyHandle addLazyStep(Init&& init, Uninit&& uninit, const Options&... options)
+    {
+        const StepHandle handle = emplaceStep<LazyStep<Init, Uninit>>(std::forward<Init>(init), std::forward<Uninit>(uninit), options...);
+        return LazyHandle(handle, static_cast<LazyStepBase*>(m_steps[handle.index]));
+    }
+
+    template <class Init, class... Options, class = std::enable_if_t<detail::AreStepOptions<Options...>::value>>
+    LazyHandle addLazyStep(Init&& init, const Options&... options)
+    {
+        return addLazyStep(std::forward<Init>(init), [](){}, options...);
+    }
+
+    /**
+     * Adds a step whose initialization lambda returns an awaitable yielding the same result as a
+     * regular initialization lambda would. Such steps are run by initializeAsync(), initialize()
+     * fails on them. Takes the same options as addStep(). Requires seqraii_async.h and C++20.
+     * errno isn't recorded once the step has been suspended, so to report an error the awaitable
+     * yields a std::error_code rather than false.
+     */
+    template <class Init, class Uninit, class... Options,
+              class = std::enable_if_t<!detail::IsStepOption<std::decay_t<Uninit>>::value>>
+    StepHandle addAsyncStep(Init&& init, Uninit&& uninit, const Options&... options)
+    {
+        return emplaceStep<AsyncStep<Init, Uninit>>(std::forward<Init>(init), std::forward<Uninit>(uninit), options...);
+    }
+
+    template <class Init, class... Options, class = std::enable_if_t<detail::AreStepOptions<Options...>::value>>
+    StepHandle addAsyncStep(Init&& init, const Options&... options)
+    {
+        return addAsyncStep(std::forward<Init>(init), [](){}, options...);
+    }
+
+    /**
+     * Adds a range of count steps sharing one pair of lambdas, which take the index of the item.
+     * The range is a single entry in the container: items are initialized in order, and if one
+     * fails, the items before it are uninitialized in reverse order and the range fails as a whole.
+     * InitResult::failedItem tells which item failed. Takes the same options as addStep(), and
+     * inChunks() to run chunks of items concurrently, in which case the lambdas must be thread-safe.
+     * Items of different chunks are then initialized and uninitialized in no particular order, a
+     * failure stops the other chunks and rolls the completed items back on the calling thread.
+     * Example: seqraii.addSteps(fds.size(), [&](std::size_t i) {fds[i] = open(...); return fds[i] >= 0;},
+     *                           [&](std::size_t i) {close(fds[i]);});
+     * @return Handle to the range, for declaring dependencies on it.
+     */
+    template <class Init, class Uninit, class... Options,
+              class = std::enable_if_t<!detail::IsStepOption<std::decay_t<Uninit>>::value>>
+    StepHandle addSteps(std::size_t count, Init&& init, Uninit&& uninit, const Options&... options)
+    {
+        const std::size_t index = m_steps.size();
+        prepareOptions(index, options...);
+
+        StepBase* step = m_steps.emplace<RangeStep<Init, Uninit>>(count, std::forward<Init>(init), std::forward<Uninit>(uninit));
+        applyOptions(*step, index, options...);
+
+        return StepHandle{index};
+    }
+
+    template <class Init, class... Options, class = std::enable_if_t<detail::AreStepOptions<Options...>::value>>
+    StepHandle addSteps(std::size_t count, Init&& init, const Options&... options)
+    {
+        return addSteps(count, std::forward<Init>(init), [](std::size_t){}, options...);
+    }
+
+    /**
+     * Runs the initialization steps in the order they were added. Steps that are already
+     * initialized are skipped, so a repeated call resumes where the previous one left off.
+     * @return True if all steps were applied successfully, false otherwise. On error the
+     *         corresponding uninitialization steps will be run to ensure a clean state.
+     */
+    bool initialize() const noexcept
+    {
+        NullObserver observer;
+        return initialize(observer);
+    }
+
+    /**
+     * Runs the initialization steps in the order they were added, reporting each step to the given
+     * observer. Any type with the hooks of StepObserver will do, calls are resolved at compile time.
+     */
+    template <class Observer, class = std::enable_if_t<detail::IsObserver<Observer>::value>>
+    bool initialize(Observer& observer) const noexcept
+    {
+        return initializeSteps(observer, 0, nullptr);
+    }
+
+    /**
+     * Runs the initialization steps in the order they were added, like initialize(), and reports
+     * which step failed and why.
+     * @param result Receives the index and label of the failing step, the error code it returned
+     *               or errno as it left it, and the exception it threw. Reset on success.
+     * @return True if all steps were applied successfully, false otherwise.
+     */
+    bool initialize(InitResult& result) const noexcept
+    {
+        NullObserver observer;
+        return initialize(observer, result);
+    }
+
+    template <class Observer, class = std::enable_if_t<detail::IsObserver<Observer>::value>>
+    bool initialize(Observer& observer, InitResult& result) const noexcept
+    {
+        result = InitResult{};
+        return initializeSteps(observer, 0, &result);
+    }
+
+    /**
+     * Runs the initialization steps in the order they were added, like initialize(), until the
+     * token asks to stop. The token is checked before the first step and after every step, and
+     * passed to initialization lambdas taking a const StopToken&. Once stopped, the initialized
+     * steps are rolled back in order.
+     * @param result Receives the step that was about to run or still running when initialization
+     *               was stopped, with std::errc::timed_out if the deadline passed and
+     *               std::errc::operation_canceled if a stop was requested.
+     * @return True if all steps were applied successfully in time, false otherwise.
+     */
+    bool initialize(const StopToken& stop, InitResult& result) const noexcept
+    {
+        NullObserver observer;
+        result = InitResult{};
+        return initializeSteps(observer, 0, &result, &stop);
+    }
+
+    bool initialize(const StopToken& stop) const noexcept
+    {
+        NullObserver observer;
+        return initializeSteps(observer, 0, nullptr, &stop);
+    }
+
+    /**
+     * Runs the initialization steps like initialize(const StopToken&), stopping at the deadline.
+     */
+    bool initialize(StopToken::Clock::time_point deadline, InitResult& result) const noexcept
+    {
+        return initialize(StopToken(deadline), result);
+    }
+
+    bool initialize(StopToken::Clock::time_point deadline) const noexcept
+    {
+        return initialize(StopToken(deadline));
+    }
+
+    /**
+     * Coroutine running the initialization steps in the order they were added, awaiting the
+     * asynchronous ones. Same semantics as initialize(). The container must outlive the returned
+     * task. Defined in seqraii_async.h, requires C++20.
+     */
+    Task<bool> initializeAsync() const;
+
+    /**
+     * Coroutine running the initialization steps like initializeAsync(), reporting each step to the
+     * given observer like initialize(Observer&). The observer must outlive the returned task.
+     */
+    template <class Observer, class = std::enable_if_t<detail::IsObserver<Observer>::value>>
+    Task<bool> initializeAsync(Observer& observer) const;
+
+    /**
+     * Coroutine running the initialization steps like initializeAsync(), reporting which step
+     * failed and why like initialize(InitResult&). The result must outlive the returned task.
+     */
+    Task<bool> initializeAsync(InitResult& result) const;
+
+    template <class Observer, class = std::enable_if_t<detail::IsObserver<Observer>::value>>
+    Task<bool> initializeAsync(Observer& observer, InitResult& result) const;
+
+    /**
+     * Runs the initialization steps on the given executor, each step as soon as the steps it depends
+     * on are initialized. See addStep() for declaring dependencies. Blocks until done.
+     * @param observer Optional observer, called from the executor's threads.
+     * @param result Optionally receives the details of the first failure, see InitResult.
+     * @return True if all steps were applied successfully, false otherwise. On error no further
+     *         steps are started, and once the running ones are done the completed steps are
+     *         uninitialized in reverse order.
+     */
+    bool initialize(Executor& executor, StepObserver* observer = nullptr, InitResult* result = nullptr) const noexcept
+    {
+        if (result)
+        {
+            *result = InitResult{};
+        }
+
+        std::unique_ptr<detail::ParallelRun> run;
+        SEQRAII_TRY
+        {
+            run = std::make_unique<detail::ParallelRun>(m_dependencies, m_initializedCount, m_steps.size(), false);
+        }
+        SEQRAII_CATCH_ALL
+        {
+            if (result)
+            {
+                result->failedStep = m_initializedCount;
+                result->error = std::make_error_code(std::errc::not_enough_memory);
+            }
+
+            return false;
+        }
+
+        run->start(m_steps, m_retryPolicies, m_affinities, m_affinity, executor, observer, result);
+
+        if (run->failed)
+        {
+            // Completed steps are no longer a prefix, so roll back by their flags.
+            for (std::size_t i = m_steps.size(); i > 0; --i)
+            {
+                if (run->completed[i - 1])
+                {
+                    if (observer)
+                    {
+                        observer->onUninitBegin(i - 1, m_steps[i - 1]->label());
+                    }
+
+                    m_steps[i - 1]->uninit();
+
+                    if (observer)
+                    {
+                        observer->onUninitEnd(i - 1, m_steps[i - 1]->label());
+                    }
+                }
+            }
+
+            m_initializedCount = 0;
+            return false;
+        }
+
+        m_initializedCount = m_steps.size();
+        return true;
+    }
+
+    /**
+     * Runs the uninitialization steps of the initialized steps in the reverse order as they were added.
+     */
+    void uninitialize() const noexcept
+    {
+        NullObserver observer;
+        uninitialize(observer);
+    }
+
+    /**
+     * Runs the uninitialization steps in the reverse order as they were added, reporting each step
+     * to the given observer.
+     */
+    template <class Observer, class = std::enable_if_t<!std::is_base_of<Executor, Observer>::value>>
+    void uninitialize(Observer& observer) const noexcept
+    {
+        uninitializeSteps(observer, 0);
+    }
+
+    /**
+     * Runs the uninitialization steps on the given executor. A step is uninitialized once all steps
+     * depending on it are, so independent steps are torn down concurrently. Blocks until done.
+     * Falls back to uninitialize() if the run could not be set up.
+     * @param observer Optional observer, called from the executor's threads.
+     */
+    void uninitialize(Executor& executor, StepObserver* observer = nullptr) const noexcept
+    {
+        std::unique_ptr<detail::ParallelRun> run;
+        SEQRAII_TRY
+        {
+            run = std::make_unique<detail::ParallelRun>(m_dependencies, 0, m_initializedCount, true);
+        }
+        SEQRAII_CATCH_ALL
+        {
+            if (observer)
+            {
+                uninitialize(*observer);
+            }
+            else
+            {
+                uninitialize();
+            }
+
+            return;
+        }
+
+        run->start(m_steps, m_retryPolicies, m_affinities, m_affinity, executor, observer, nullptr);
+        m_initializedCount = 0;
+    }
+
+    /**
+     * Hands the initialized steps to the reaper, which uninitializes them in reverse order later,
+     * so that this thread doesn't pay for closing and freeing. This container is left empty. Falls
+     * back to uninitialize() if the reaper refuses the sequence. The steps must not refer to
+     * anything destroyed before the reaper gets to them.
+     */
+    void retireAsync(Reaper& reaper) noexcept
+    {
+        if (m_initializedCount == 0 || !reaper.retire(*this))
+        {
+            uninitialize();
+        }
+    }
+
+    /**
+     * Makes the destructor retire the initialized steps to the given reaper, see retireAsync(),
+     * instead of uninitializing them right away. Null restores the default.
+     */
+    void setReaper(Reaper* reaper) noexcept
+    {
+        m_reaper = reaper;
+    }
+
+    /**
+     * Initializes every step added without an affinity of its own on the given CPUs, e.g. those of
+     * the NUMA node the sequence's resources will be used on. Applies to the parallel initialize()
+     * too, binding the executor's threads for the duration of each step. Steps that pin their thread
+     * for good, such as addThreadAffinity(), are exempt.
+     */
+    void setAffinity(const Affinity& affinity) noexcept
+    {
+        m_affinity = affinity;
+    }
+
+    /**
+     * Marks the current end of the step list. Steps added from now on form the checkpoint's tail,
+     * which can be rolled back and initialized again on its own.
+     */
+    Checkpoint checkpoint() const noexcept
+    {
+        return Checkpoint{m_steps.size()};
+    }
+
+    /**
+     * Uninitializes the tail of the given checkpoint in reverse order, leaving the steps before it
+     * initialized.
+     */
+    void rollbackTo(Checkpoint checkpoint) const noexcept
+    {
+        NullObserver observer;
+        rollbackTo(checkpoint, observer);
+    }
+
+    template <class Observer>
+    void rollbackTo(Checkpoint checkpoint, Observer& observer) const noexcept
+    {
+        uninitializeSteps(observer, checkpoint.index);
+    }
+
+    /**
+     * Re-initializes the tail of the given checkpoint: rolls it back if initialized, then runs
+     * initialize(). Steps before the checkpoint are kept as they are, and must all be initialized.
+     * @return True if all steps were applied successfully, false otherwise. On error only the tail
+     *         is rolled back, the steps before the checkpoint stay initialized. False without running
+     *         any step if some step before the checkpoint isn't initialized; use initialize() then.
+     */
+    bool initializeFrom(Checkpoint checkpoint) const noexcept
+    {
+        NullObserver observer;
+        return initializeFrom(checkpoint, observer);
+    }
+
+    template <class Observer>
+    bool initializeFrom(Checkpoint checkpoint, Observer& observer) const noexcept
+    {
+        // Rolling back to the checkpoint on error would leave part of a prefix run here initialized.
+        if (checkpoint.index > m_initializedCount)
+        {
+            return false;
+        }
+
+        uninitializeSteps(observer, checkpoint.index);
+        return initializeSteps(observer, checkpoint.index, nullptr);
+    }
+
+    /**
+     * Runs the verify() checks of the initialized steps in the order they were added, stopping at
+     * the first step failing its check.
+     * @return Index of the first step heal() would initialize again: the first one failing its
+     *         check, else the first one not initialized. InitResult::kNoStep if all steps are
+     *         initialized and pass their checks.
+     */
+    std::size_t checkHealth() const noexcept
+    {
+        for (const auto& verifier : m_verifiers)
+        {
+            if (verifier.first >= m_initializedCount)
+            {
+                break;
+            }
+
+            bool healthy = false;
+            SEQRAII_TRY
+            {
+                healthy = (*verifier.second)();
+            }
+            SEQRAII_CATCH_ALL
+            {
+            }
+
+            if (!healthy)
+            {
+                return verifier.first;
+            }
+        }
+
+        if (m_initializedCount < m_steps.size())
+        {
+            return m_initializedCount;
+        }
+
+        return InitResult::kNoStep;
+    }
+
+    /**
+     * Repairs the sequence after resources broke underneath it, without a full restart. Finds the
+     * first step failing its check, see checkHealth(), uninitializes the steps from it onwards in
+     * reverse order and initializes them again. The steps before it stay initialized, and so does
+     * whatever state they hold. Steps after the broken one are initialized again even if they don't
+     * depend on it. Calling heal() on a healthy sequence only runs the checks.
+     * @return True if all steps are initialized afterwards. On failure the steps from the broken
+     *         one onwards are left uninitialized, and the next heal() tries them again.
+     */
+    bool heal() const noexcept
+    {
+        NullObserver observer;
+        return healSteps(observer, nullptr);
+    }
+
+    template <class Observer, class = std::enable_if_t<detail::IsObserver<Observer>::value>>
+    bool heal(Observer& observer) const noexcept
+    {
+        return healSteps(observer, nullptr);
+    }
+
+    /**
+     * Repairs the sequence like heal(), and reports which step failed to initialize again and why.
+     */
+    bool heal(InitResult& result) const noexcept
+    {
+        NullObserver observer;
+        result = InitResult{};
+        return healSteps(observer, &result);
+    }
+
+    /**
+     * @return Number of steps currently initialized. These are always the first steps added.
+     */
+    std::size_t initializedSteps() const noexcept
+    {
+        return m_initializedCount;
+    }
+
+    /**
+     * @return Number of steps added.
+     */
+    std::size_t size() const noexcept
+    {
+        return m_steps.size();
+    }
+
+    /**
+     * @return Steps the given step depends on: those passed to after(), or the step added before
+     *         it if it was added without after().
+     */
+    std::vector<std::size_t> dependencies(std::size_t index) const
+    {
+        std::vector<std::size_t> result;
+        auto it = std::lower_bound(m_dependencies.begin(), m_dependencies.end(), index,
+            [](const std::pair<std::size_t, std::size_t>& entry, std::size_t i) {return entry.first < i;});
+
+        if (it == m_dependencies.end() || it->first != index)
+        {
+            if (index > 0)
+            {
+                result.push_back(index - 1);
+            }
+
+            return result;
+        }
+
+        for (; it != m_dependencies.end() && it->first == index; ++it)
+        {
+            if (it->second != detail::ParallelRun::kNoStep)
+            {
+                result.push_back(it->second);
+            }
+        }
+
+        return result;
+    }
+
+private:
+    // Blueprints add their steps and options directly.
+    template <class Context> friend class SequenceBlueprint;
+
+    template <class Observer>
+    bool healSteps(Observer& observer, InitResult* result) const noexcept
+    {
+        const std::size_t broken = checkHealth();
+        if (broken == InitResult::kNoStep)
+        {
+            return true;
+        }
+
+        uninitializeSteps(observer, broken);
+        return initializeSteps(observer, broken, result);
+    }
+
+    /**
+     * Initializes the steps from the high-water mark onwards.
+     * @param rollbackIndex Index down to which steps are rolled back on failure.
+     * @param result Receives the details of a failure, if not null.
+     * @param stop Checked before the first step and after every step, if not null.
+     */
+    template <class Observer>
+    bool initializeSteps(Observer& observer, std::size_t rollbackIndex, InitResult* result, const StopToken* stop = nullptr) const noexcept
+    {
+        if (stop && m_initializedCount < m_steps.size() && stop->stopRequested())
+        {
+            stopped(m_initializedCount, *stop, result);
+            uninitializeSteps(observer, rollbackIndex);
+            return false;
+        }
+
+        const bool bind = detail::hasAffinity(m_affinities, m_affinity);
+        for (; m_initializedCount < m_steps.size(); ++m_initializedCount)
+        {
+            const std::size_t i = m_initializedCount;
+            StepBase* step = m_steps[i];
+            observer.onInitBegin(i, step->label());
+            const bool success = detail::initStep(*step, i, m_retryPolicies, result, stop,
+                                                  bind ? detail::findAffinity(m_affinities, m_affinity, i) : nullptr);
+            observer.onInitEnd(i, step->label(), success);
+
+            // A step that only finished once the token asked to stop is rolled back too.
+            const bool wasStopped = stop && stop->stopRequested();
+            if (!success || wasStopped)
+            {
+                if (success)
+                {
+                    ++m_initializedCount;
+                }
+
+                if (wasStopped)
+                {
+                    stopped(i, *stop, result);
+                }
+
+                observer.onFailure(i, step->label());
+                uninitializeSteps(observer, rollbackIndex);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Coroutine behind the initializeAsync() overloads, see initializeSteps(). Defined in
+     * seqraii_async.h.
+     */
+    template <class Observer>
+    Task<bool> initializeStepsAsync(Observer& observer, InitResult* result) const;
+
+    /**
+     * Reports that initialization was stopped at the given step.
+     */
+    void stopped(std::size_t index, const StopToken& stop, InitResult* result) const noexcept
+    {
+        if (result)
+        {
+            result->failedStep = index;
+            result->label = m_steps[index]->label();
+            result->error = std::make_error_code(stop.timedOut() ? std::errc::timed_out : std::errc::operation_canceled);
+        }
+    }
+
+    /**
+     * Uninitializes the initialized steps from the high-water mark down to the given index.
+     */
+    template <class Observer>
+    void uninitializeSteps(Observer& observer, std::size_t index) const noexcept
+    {
+        for (; m_initializedCount > index; --m_initializedCount)
+        {
+            const std::size_t i = m_initializedCount - 1;
+            StepBase* step = m_steps[i];
+            observer.onUninitBegin(i, step->label());
+            step->uninit();
+            observer.onUninitEnd(i, step->label());
+        }
+    }
+
+    /**
+     * Adds a step of the given type after validating its options. Options are applied once the
+     * step is in place, which must not throw.
+     */
+    template <class StepType, class Init, class Uninit, class... Options>
+    StepHandle emplaceStep(Init&& init, Uninit&& uninit, const Options&... options)
+    {
+        const std::size_t index = m_steps.size();
+        prepareOptions(index, options...);
+
+        StepBase* step = m_steps.emplace<StepType>(std::forward<Init>(init), std::forward<Uninit>(uninit));
+        applyOptions(*step, index, options...);
+
+        return StepHandle{index};
+    }
+
+    void prepareOptions(std::size_t) noexcept
+    {}
+
+    template <class Option, class... Rest>
+    void prepareOptions(std::size_t index, const Option& option, const Rest&... rest)
+    {
+        prepareOption(index, option);
+        prepareOptions(index, rest...);
+    }
+
+    void applyOptions(StepBase&, std::size_t) noexcept
+    {}
+
+    template <class Option, class... Rest>
+    void applyOptions(StepBase& step, std::size_t index, const Option& option, const Rest&... rest) noexcept
+    {
+        applyOption(step, index, option);
+        applyOptions(step, index, rest...);
+    }
+
+    void prepareOption(std::size_t index, const Dependencies& dependencies)
+    {
+        for (const StepHandle& dependency : dependencies.steps)
+        {
+            if (dependency.index >= index)
+            {
+                SEQRAII_THROW(std::invalid_argument("SequentialRaii: dependency on unknown step"));
+            }
+        }
+
+        m_dependencies.reserve(m_dependencies.size() + dependencies.steps.size() + 1);
+    }
+
+    void applyOption(StepBase&, std::size_t index, const Dependencies& dependencies) noexcept
+    {
+        // Record an empty entry for steps without dependencies, to tell them from implicit ones.
+        if (dependencies.steps.empty())
+        {
+            m_dependencies.emplace_back(index, std::size_t(detail::ParallelRun::kNoStep));
+        }
+
+        for (const StepHandle& dependency : dependencies.steps)
+        {
+            m_dependencies.emplace_back(index, dependency.index);
+        }
+    }
+
+    void prepareOption(std::size_t, const Label&) noexcept
+    {}
+
+    void applyOption(StepBase& step, std::size_t, const Label& name) noexcept
+    {
+        step.setLabel(name.name);
+    }
+
+    void prepareOption(std::size_t, const RetryPolicy&)
+    {
+        m_retryPolicies.reserve(m_retryPolicies.size() + 1);
+    }
+
+    void applyOption(StepBase&, std::size_t index, const RetryPolicy& policy) noexcept
+    {
+        m_retryPolicies.emplace_back(index, policy);
+    }
+
+    void prepareOption(std::size_t, const Chunks&) noexcept
+    {}
+
+    void applyOption(StepBase& step, std::size_t, const Chunks& chunks) noexcept
+    {
+        if (RangeStepBase* range = step.asRange())
+        {
+            range->setChunks(chunks);
+        }
+    }
+
+    void prepareOption(std::size_t, const Verify&)
+    {
+        m_verifiers.reserve(m_verifiers.size() + 1);
+    }
+
+    void applyOption(StepBase&, std::size_t index, const Verify& check) noexcept
+    {
+        m_verifiers.emplace_back(index, check.check);
+    }
+
+    void prepareOption(std::size_t, const Affinity&)
+    {
+        m_affinities.reserve(m_affinities.size() + 1);
+    }
+
+    void applyOption(StepBase&, std::size_t index, const Affinity& affinity) noexcept
+    {
+        // The first affinity of a step wins, so that repeating the option needs no more room than
+        // prepareOption() made.
+        if (m_affinities.empty() || m_affinities.back().first != index)
+        {
+            m_affinities.emplace_back(index, affinity);
+        }
+    }
+
+    /**
+     * Keep track of the steps and the order they are added in. Steps are stored contiguously in
+     * a monotonic buffer, so building and walking a sequence does not chase heap pointers.
+     */
+    detail::StepStorage m_steps;
+
+    /**
+     * Explicitly declared dependencies as (step, dependency) pairs, in the order steps were added.
+     * Empty until a step is added with dependencies, so sequential use pays nothing for it.
+     */
+    std::vector<std::pair<std::size_t, std::size_t>> m_dependencies;
+
+    /// Retry policies of the steps added with one. Only looked at when a step fails.
+    detail::RetryPolicies m_retryPolicies;
+
+    /// Affinities of the steps added with one, and of all other steps.
+    detail::Affinities m_affinities;
+    Affinity m_affinity;
+
+    /// Health checks of the steps added with one. Only looked at by checkHealth() and heal().
+    detail::Verifiers m_verifiers;
+
+    /**
+     * High-water mark of initialization: the steps before it are initialized, the ones from it
+     * are not. Lets initialize() resume and uninitialize() skip steps that never ran.
+     */
+    mutable std::size_t m_initializedCount = 0;
+
+    /// Reaper the destructor retires initialized steps to, if set.
+    Reaper* m_reaper = nullptr;
 };
 
-// Forward declaration.
-template <class Init, class Uninit> class Step;
 
 /**
- * Container class for sequential raii steps.
+ * Utility class holding onto the initialization and uninitialization code for each step. 
  */
-class SequentialRaii
+template <class Init, class Uninit>
+class Step final : public StepBase
 {
 public:
-    /**
-     * Constructs a container for sequential initialization.
-     */
-    SequentialRaii() noexcept
-        : m_steps()
+    Step(Init&& init_, Uninit&& uninit_) noexcept
+        : m_init(std::forward<Init>(init_))
+        , m_uninit(std::forward<Uninit>(uninit_))
     {}
 
     /**
-     * Add that feeling of RAII by always cleaning up after us.
+     * Runs the initialization code for this step.
+     * @return Returns true if initialization code ran without any errors, false otherwise.
      */
-    ~SequentialRaii() noexcept
+    virtual bool init(InitResult* result, const StopToken* stop) noexcept override
     {
-        uninitialize();
+        // Only pay for clearing errno when someone asks for the failure details.
+        if (result)
+        {
+            errno = 0;
+        }
+
+        return detail::runStoppableInit(m_init, result, stop);
     }
 
-    // Disable copy constructor and copy-assignment operator.
-    SequentialRaii(const SequentialRaii&) = delete;
-    SequentialRaii& operator=(const SequentialRaii&) = delete;
+    /**
+     * Runs the uninitialization code. The container makes sure this only happens for steps that
+     * have been initialized.
+     */
+    virtual void uninit() noexcept override
+    {
+        detail::runUninit(m_uninit);
+    }
 
-    // Enable move-semantics.
-    SequentialRaii(SequentialRaii&& rhs) noexcept
+    virtual StepBase* relocate(unsigned char* oldBase, unsigned char* newBase) noexcept override
     {
-        uninitialize();
-        std::swap(m_steps, rhs.m_steps);
+        return detail::relocate(this, oldBase, newBase, std::is_nothrow_move_constructible<Step>{});
     }
 
-    SequentialRaii& operator=(SequentialRaii&& rhs) noexcept
+private:
+    Init m_init;
+    Uninit m_uninit;
+};
+
+/**
+ * Step added by SequentialRaii::addSteps(), running its lambdas once per item of the range.
+ */
+template <class Init, class Uninit>
+class RangeStep final : public RangeStepBase
+{
+public:
+    RangeStep(std::size_t count, Init&& init_, Uninit&& uninit_) noexcept
+        : RangeStepBase(count)
+        , m_init(std::forward<Init>(init_))
+        , m_uninit(std::forward<Uninit>(uninit_))
+    {}
+
+    /**
+     * Initializes all items, or none once an item fails or initialization is asked to stop.
+     */
+    virtual bool init(InitResult* result, const StopToken* stop) noexcept override
     {
-        uninitialize();
-        std::swap(m_steps, rhs.m_steps);
-        return *this;
+        const std::size_t chunks = chunkCount();
+        std::shared_ptr<detail::ChunkRun> run;
+        if (chunks > 1)
+        {
+            SEQRAII_TRY
+            {
+                run = std::make_shared<detail::ChunkRun>(chunks);
+            }
+            SEQRAII_CATCH_ALL
+            {
+            }
+        }
+
+        // Also taken when there is no memory for the chunks.
+        if (!run)
+        {
+            std::size_t done = 0;
+            if (initItems(0, m_count, result, stop, nullptr, done) && done == m_count)
+            {
+                return true;
+            }
+
+            uninitItems(0, done);
+            return false;
+        }
+
+        const std::size_t size = m_chunks.size;
+        detail::runChunks(*m_chunks.executor, run,
+            [this, result, stop, size](detail::ChunkRun& chunkRun, std::size_t chunk)
+            {
+                const std::size_t begin = chunk * size;
+                const std::size_t end = std::min(begin + size, m_count);
+                InitResult itemResult;
+                std::size_t done = begin;
+                const bool success = initItems(begin, end, result ? &itemResult : nullptr, stop, &chunkRun.failed, done);
+                chunkRun.completed[chunk] = done - begin;
+                if (!success)
+                {
+                    std::lock_guard<std::mutex> lock(chunkRun.mutex);
+                    if (!chunkRun.failed.exchange(true))
+                    {
+                        chunkRun.result = std::move(itemResult);
+                    }
+                }
+                else if (done != end)
+                {
+                    chunkRun.failed.store(true);
+                }
+            });
+
+        if (!run->failed.load())
+        {
+            return true;
+        }
+
+        for (std::size_t chunk = chunks; chunk > 0; --chunk)
+        {
+            const std::size_t begin = (chunk - 1) * size;
+            uninitItems(begin, begin + run->completed[chunk - 1]);
+        }
+
+        if (result)
+        {
+            *result = std::move(run->result);
+        }
+
+        return false;
     }
 
     /**
-     * Adds a step to the initialization queue. Call initialize() to run any queued steps.
-     * @param init Initialization lambda. Must return true on success, false or throw otherwise.
-     * @param uninit Uninitialization lambda, can be omitted. Will be executed if the initialization
-     *               lambda was successfully run.
+     * Uninitializes all items, in reverse order within each chunk.
      */
-    template <class Init, class Uninit>
-    void addStep(Init&& init, Uninit&& uninit)
+    virtual void uninit() noexcept override
     {
-        m_steps.emplace_back(std::make_unique<Step<Init, Uninit>>(std::forward<Init>(init), std::forward<Uninit>(uninit)));
+        const std::size_t chunks = chunkCount();
+        std::shared_ptr<detail::ChunkRun> run;
+        if (chunks > 1)
+        {
+            SEQRAII_TRY
+            {
+                run = std::make_shared<detail::ChunkRun>(chunks);
+            }
+            SEQRAII_CATCH_ALL
+            {
+            }
+        }
+
+        if (!run)
+        {
+            uninitItems(0, m_count);
+            return;
+        }
+
+        const std::size_t size = m_chunks.size;
+        detail::runChunks(*m_chunks.executor, run,
+            [this, size](detail::ChunkRun&, std::size_t chunk)
+            {
+                const std::size_t begin = chunk * size;
+                uninitItems(begin, std::min(begin + size, m_count));
+            });
     }
 
-    template <class Init>
-    void addStep(Init&& init)
+    virtual StepBase* relocate(unsigned char* oldBase, unsigned char* newBase) noexcept override
     {
-        addStep(std::forward<Init>(init), [](){});
+        return detail::relocate(this, oldBase, newBase, std::is_nothrow_move_constructible<RangeStep>{});
     }
 
+private:
     /**
-     * Runs the initialization steps in the order they were added.
-     * @return True if all steps were applied successfully, false otherwise. On error the
-     *         corresponding uninitialization steps will be run to ensure a clean state.
+     * Initializes the items from begin up to end, until one fails or the token or the abort flag
+     * asks to stop.
+     * @param done Receives the index of the first item not initialized.
+     * @return False if an item failed.
      */
-    bool initialize() const noexcept
+    bool initItems(std::size_t begin, std::size_t end, InitResult* result, const StopToken* stop,
+                   const std::atomic<bool>* abort, std::size_t& done) noexcept
     {
-        for (const auto& step : m_steps)
+        for (done = begin; done < end; ++done)
         {
-            if (!step->init())
+            if ((abort && abort->load(std::memory_order_relaxed)) || (stop && stop->stopRequested()))
             {
-                uninitialize();
+                return true;
+            }
+
+            if (result)
+            {
+                errno = 0;
+            }
+
+            std::size_t item = done;
+            if (!detail::runStoppableInit(m_init, result, stop, item))
+            {
+                if (result)
+                {
+                    result->failedItem = done;
+                }
+
                 return false;
             }
         }
@@ -103,84 +2826,267 @@ public:
         return true;
     }
 
+    void uninitItems(std::size_t begin, std::size_t end) noexcept
+    {
+        for (std::size_t i = end; i > begin; --i)
+        {
+            std::size_t item = i - 1;
+            detail::runUninit(m_uninit, item);
+        }
+    }
+
+    Init m_init;
+    Uninit m_uninit;
+};
+
+/**
+ * Step added by SequentialRaii::addLazyStep(). Initializing it through the sequence only arms it,
+ * acquire() runs the initialization lambda. Holds a mutex, so it is never relocated and handles to
+ * it stay valid when the sequence is moved.
+ */
+template <class Init, class Uninit>
+class LazyStep final : public LazyStepBase
+{
+public:
+    LazyStep(Init&& init_, Uninit&& uninit_) noexcept
+        : m_init(std::forward<Init>(init_))
+        , m_uninit(std::forward<Uninit>(uninit_))
+    {}
+
+    virtual bool init(InitResult*, const StopToken*) noexcept override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state.store(kArmed, std::memory_order_relaxed);
+        return true;
+    }
+
+    virtual bool acquire() noexcept override
+    {
+        if (m_state.load(std::memory_order_acquire) == kReady)
+        {
+            return true;
+        }
+
+        // Threads arriving while the step initializes wait here for the result.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const State state = m_state.load(std::memory_order_relaxed);
+        if (state != kArmed)
+        {
+            return state == kReady;
+        }
+
+        const bool success = detail::runInit(m_init, nullptr);
+        if (success)
+        {
+            m_state.store(kReady, std::memory_order_release);
+        }
+
+        return success;
+    }
+
     /**
-     * Runs the uninitialization steps in the reverse order as they were added.
+     * Runs the uninitialization code if the step was acquired, and disarms it.
      */
-    void uninitialize() const noexcept
+    virtual void uninit() noexcept override
     {
-        for (auto it = m_steps.rbegin(); it != m_steps.rend(); ++it)
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_state.load(std::memory_order_relaxed) == kReady)
         {
-            it->get()->uninit();
+            detail::runUninit(m_uninit);
         }
+
+        m_state.store(kIdle, std::memory_order_relaxed);
+    }
+
+    virtual StepBase* relocate(unsigned char* oldBase, unsigned char* newBase) noexcept override
+    {
+        return detail::relocate(this, oldBase, newBase, std::false_type{});
     }
 
 private:
-    /**
-     * Keep track of the steps and the order they are added in. Uses unique_ptr to enable
-     * polymorphism and to ensure no copying is taking place during memory reallocations.
-     */
-    std::vector<std::unique_ptr<StepBase>> m_steps;
-};
+    enum State : int
+    {
+        kIdle,
+        kArmed,
+        kReady
+    };
 
+    Init m_init;
+    Uninit m_uninit;
+    std::atomic<State> m_state{kIdle};
+    std::mutex m_mutex;
+};
 
 /**
- * Utility class holding onto the initialization and uninitialization code for each step. 
+ * Step stored by value inside a StaticSequentialRaii. Same semantics as Step, but without the
+ * virtual interface so that calls can be resolved and inlined at compile time.
  */
 template <class Init, class Uninit>
-class Step final : public StepBase
+class StaticStep final
 {
 public:
-    Step(Init&& init_, Uninit&& uninit_) noexcept
-        : m_init(std::forward<Init>(init_))
-        , m_uninit(std::forward<Uninit>(uninit_))
+    template <class I, class U>
+    StaticStep(I&& init_, U&& uninit_)
+        : m_init(std::forward<I>(init_))
+        , m_uninit(std::forward<U>(uninit_))
     {}
 
     /**
      * Runs the initialization code for this step.
      * @return Returns true if initialization code ran without any errors, false otherwise.
      */
-    virtual bool init() noexcept override
+    bool init() noexcept
+    {
+        return detail::runInit(m_init, nullptr);
+    }
+
+    /**
+     * Runs the uninitialization code. The owning container makes sure this is only called for
+     * steps that have been successfully initialized.
+     */
+    void uninit() noexcept
+    {
+        detail::runUninit(m_uninit);
+    }
+
+private:
+    Init m_init;
+    Uninit m_uninit;
+};
+
+/**
+ * Creates a step for use with makeSequence().
+ * @param init Initialization lambda. Must return true on success, false or throw otherwise.
+ * @param uninit Uninitialization lambda, can be omitted. Will be executed if the initialization
+ *               lambda was successfully run.
+ */
+template <class Init, class Uninit>
+StaticStep<std::decay_t<Init>, std::decay_t<Uninit>> step(Init&& init, Uninit&& uninit)
+{
+    return {std::forward<Init>(init), std::forward<Uninit>(uninit)};
+}
+
+template <class Init>
+auto step(Init&& init)
+{
+    return step(std::forward<Init>(init), [](){});
+}
+
+/**
+ * Container class for a sequence of steps known at compile time. The steps are kept by value in
+ * a tuple and initialize()/uninitialize() are unrolled, so no heap allocation or virtual dispatch
+ * takes place. Behaves like SequentialRaii: steps are initialized in order, uninitialized in
+ * reverse order, and a failed initialization rolls back the steps that succeeded.
+ */
+template <class... Steps>
+class StaticSequentialRaii
+{
+public:
+    /**
+     * Constructs a container from a set of steps, see step() and makeSequence().
+     */
+    explicit StaticSequentialRaii(Steps... steps)
+        : m_steps(std::move(steps)...)
+    {}
+
+    /**
+     * Add that feeling of RAII by always cleaning up after us.
+     */
+    ~StaticSequentialRaii() noexcept
+    {
+        uninitialize();
+    }
+
+    // Disable copy constructor and copy-assignment operator.
+    StaticSequentialRaii(const StaticSequentialRaii&) = delete;
+    StaticSequentialRaii& operator=(const StaticSequentialRaii&) = delete;
+
+    // Enable move construction. Lambdas are not assignable, hence no move-assignment.
+    StaticSequentialRaii(StaticSequentialRaii&& rhs)
+        : m_steps(std::move(rhs.m_steps))
+        , m_initializedCount(rhs.m_initializedCount)
+    {
+        rhs.m_initializedCount = 0;
+    }
+
+    StaticSequentialRaii& operator=(StaticSequentialRaii&&) = delete;
+
+    /**
+     * Runs the initialization steps in the order they were given.
+     * @return True if all steps were applied successfully, false otherwise. On error the
+     *         corresponding uninitialization steps will be run to ensure a clean state.
+     */
+    bool initialize() noexcept
     {
-        if (!m_isInitialized)
+        if (!initFrom(std::integral_constant<std::size_t, 0>{}))
         {
-            try
-            {
-                m_isInitialized = m_init();
-            }
-            catch (...)
-            {
-            }
+            uninitialize();
+            return false;
         }
 
-        return m_isInitialized;
+        return true;
     }
 
     /**
-     * Runs the uninitialization code if initialization code has been executed previously.
+     * Runs the uninitialization steps in the reverse order as they were given.
      */
-    virtual void uninit() noexcept override
+    void uninitialize() noexcept
+    {
+        uninitFrom(std::integral_constant<std::size_t, sizeof...(Steps)>{});
+        m_initializedCount = 0;
+    }
+
+private:
+    template <std::size_t I>
+    bool initFrom(std::integral_constant<std::size_t, I>) noexcept
     {
-        if (m_isInitialized)
+        // Steps below the count have been initialized by a previous call.
+        if (I >= m_initializedCount)
         {
-            try
-            {
-                m_uninit();
-            }
-            catch (...)
+            if (!std::get<I>(m_steps).init())
             {
+                return false;
             }
+
+            m_initializedCount = I + 1;
         }
 
-        m_isInitialized = false;
-        return;
+        return initFrom(std::integral_constant<std::size_t, I + 1>{});
     }
 
-private:
-    /// State flag indicating whether initialization code has been executed or not.
-    bool m_isInitialized = false;
+    bool initFrom(std::integral_constant<std::size_t, sizeof...(Steps)>) noexcept
+    {
+        return true;
+    }
 
-    Init m_init;
-    Uninit m_uninit;
+    template <std::size_t I>
+    void uninitFrom(std::integral_constant<std::size_t, I>) noexcept
+    {
+        if (I - 1 < m_initializedCount)
+        {
+            std::get<I - 1>(m_steps).uninit();
+        }
+
+        uninitFrom(std::integral_constant<std::size_t, I - 1>{});
+    }
+
+    void uninitFrom(std::integral_constant<std::size_t, 0>) noexcept
+    {}
+
+    std::tuple<Steps...> m_steps;
+
+    /// Number of leading steps that are currently initialized.
+    std::size_t m_initializedCount = 0;
 };
 
+/**
+ * Builds a StaticSequentialRaii from steps created with step().
+ * Example: auto seq = makeSequence(step(openFn, closeFn), step(configureFn));
+ */
+template <class... Steps>
+StaticSequentialRaii<std::decay_t<Steps>...> makeSequence(Steps&&... steps)
+{
+    return StaticSequentialRaii<std::decay_t<Steps>...>(std::forward<Steps>(steps)...);
+}
+
 } // Namespace sequentialraii
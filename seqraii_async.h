@@ -0,0 +1,321 @@
+/**
+ * Asynchronous steps for SequentialRaii using C++20 coroutines.
+ *
+ * License: MIT license. See separate file for full disclaimer.
+ * Compile with C++20 enabled.
+ */
+#pragma once
+
+#include "seqraii.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace sequentialraii
+{
+/**
+ * Lazily started coroutine producing a value of type T. Awaiting the task starts it, and the
+ * awaiting coroutine is resumed once the task has finished. From plain code the task is started
+ * with start(), after which done() and result() can be polled, e.g. from an event loop.
+ * Exceptions thrown by the coroutine are rethrown to whoever collects the result.
+ */
+template <class T>
+class [[nodiscard]] Task
+{
+public:
+    struct promise_type
+    {
+        Task get_return_object() noexcept
+        {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        /// Transfers control back to the awaiting coroutine, if there is one.
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+            {
+                auto continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept
+            {}
+        };
+
+        FinalAwaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_value(T value)
+        {
+            result.emplace(std::move(value));
+        }
+
+        void unhandled_exception() noexcept
+        {
+            exception = std::current_exception();
+        }
+
+        std::optional<T> result;
+        std::exception_ptr exception;
+        std::coroutine_handle<> continuation;
+    };
+
+    Task(Task&& rhs) noexcept
+        : m_handle(std::exchange(rhs.m_handle, nullptr))
+    {}
+
+    Task& operator=(Task&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            destroy();
+            m_handle = std::exchange(rhs.m_handle, nullptr);
+        }
+
+        return *this;
+    }
+
+    ~Task() noexcept
+    {
+        destroy();
+    }
+
+    /**
+     * Starts the task from plain code. Runs until the coroutine first suspends or finishes.
+     */
+    void start()
+    {
+        m_handle.resume();
+    }
+
+    bool done() const noexcept
+    {
+        return m_handle.done();
+    }
+
+    /**
+     * @return The value produced by a finished task. Rethrows if the coroutine threw.
+     */
+    T result()
+    {
+        if (m_handle.promise().exception)
+        {
+            std::rethrow_exception(m_handle.promise().exception);
+        }
+
+        return std::move(*m_handle.promise().result);
+    }
+
+    bool await_ready() const noexcept
+    {
+        return m_handle.done();
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+
+    T await_resume()
+    {
+        return result();
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept
+        : m_handle(handle)
+    {}
+
+    void destroy() noexcept
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+        }
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace detail
+{
+/**
+ * Turns what an asynchronous step yielded into success or failure. Unlike toSuccess(), errno is
+ * never recorded: whatever ran while the step was suspended may have changed it, also on another
+ * thread. A step reports its error by yielding a std::error_code.
+ */
+inline bool toAsyncSuccess(bool success, InitResult*) noexcept
+{
+    return success;
+}
+
+inline bool toAsyncSuccess(const std::error_code& error, InitResult* result) noexcept
+{
+    return toSuccess(error, result);
+}
+
+} // Namespace detail
+
+/**
+ * Base class of steps whose initialization is awaitable.
+ */
+class AsyncStepBase : public StepBase
+{
+public:
+    /**
+     * Runs the initialization code for this step.
+     * @param result Receives the error or exception of a failure. Null when the caller doesn't care.
+     * @return Task yielding true if initialization code ran without any errors, false otherwise.
+     */
+    virtual Task<bool> initAsync(InitResult* result) = 0;
+
+    virtual AsyncStepBase* asAsync() noexcept override
+    {
+        return this;
+    }
+};
+
+/**
+ * Utility class holding onto the asynchronous initialization and the uninitialization code for a
+ * step. The initialization lambda returns an awaitable yielding bool, e.g. a Task<bool>.
+ */
+template <class Init, class Uninit>
+class AsyncStep final : public AsyncStepBase
+{
+public:
+    AsyncStep(Init&& init_, Uninit&& uninit_) noexcept
+        : m_init(std::forward<Init>(init_))
+        , m_uninit(std::forward<Uninit>(uninit_))
+    {}
+
+    /**
+     * Asynchronous steps can't complete without being awaited, so plain initialization fails.
+     */
+    virtual bool init(InitResult* result, const StopToken*) noexcept override
+    {
+        if (result)
+        {
+            result->error = std::make_error_code(std::errc::operation_not_supported);
+        }
+
+        return false;
+    }
+
+    virtual Task<bool> initAsync(InitResult* result) override
+    {
+        bool success = false;
+        SEQRAII_TRY
+        {
+            success = detail::toAsyncSuccess(co_await m_init(), result);
+        }
+        SEQRAII_CATCH_ALL
+        {
+            if (result)
+            {
+                result->exception = std::current_exception();
+            }
+        }
+
+        co_return success;
+    }
+
+    /**
+     * Runs the uninitialization code. The container makes sure this only happens for steps that
+     * have been initialized.
+     */
+    virtual void uninit() noexcept override
+    {
+        detail::runUninit(m_uninit);
+    }
+
+    virtual StepBase* relocate(unsigned char* oldBase, unsigned char* newBase) noexcept override
+    {
+        return detail::relocate(this, oldBase, newBase, std::is_nothrow_move_constructible<AsyncStep>{});
+    }
+
+private:
+    Init m_init;
+    Uninit m_uninit;
+};
+
+inline Task<bool> SequentialRaii::initializeAsync() const
+{
+    NullObserver observer;
+    co_return co_await initializeStepsAsync(observer, nullptr);
+}
+
+template <class Observer, class>
+Task<bool> SequentialRaii::initializeAsync(Observer& observer) const
+{
+    return initializeStepsAsync(observer, nullptr);
+}
+
+inline Task<bool> SequentialRaii::initializeAsync(InitResult& result) const
+{
+    NullObserver observer;
+    co_return co_await initializeAsync(observer, result);
+}
+
+template <class Observer, class>
+Task<bool> SequentialRaii::initializeAsync(Observer& observer, InitResult& result) const
+{
+    // Reset once the task starts, like the steps it reports on.
+    result = InitResult{};
+    co_return co_await initializeStepsAsync(observer, &result);
+}
+
+template <class Observer>
+Task<bool> SequentialRaii::initializeStepsAsync(Observer& observer, InitResult* result) const
+{
+    const bool bind = detail::hasAffinity(m_affinities, m_affinity);
+    for (; m_initializedCount < m_steps.size(); ++m_initializedCount)
+    {
+        const std::size_t i = m_initializedCount;
+        StepBase* step = m_steps[i];
+        AsyncStepBase* async = step->asAsync();
+        observer.onInitBegin(i, step->label());
+        bool success = false;
+        if (async)
+        {
+            success = co_await async->initAsync(result);
+            if (!success && result)
+            {
+                result->failedStep = i;
+                result->label = step->label();
+            }
+        }
+        else
+        {
+            success = detail::initStep(*step, i, m_retryPolicies, result, nullptr,
+                                       bind ? detail::findAffinity(m_affinities, m_affinity, i) : nullptr);
+        }
+
+        observer.onInitEnd(i, step->label(), success);
+        if (!success)
+        {
+            observer.onFailure(i, step->label());
+            uninitializeSteps(observer, 0);
+            co_return false;
+        }
+    }
+
+    co_return true;
+}
+
+} // Namespace sequentialraii
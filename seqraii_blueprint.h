@@ -0,0 +1,377 @@
+/**
+ * Sequences described once and instantiated many times, each instance with its own state.
+ *
+ * License: MIT license. See separate file for full disclaimer.
+ * Compile with C++14 enabled.
+ */
+#pragma once
+
+#include "seqraii.h"
+
+#include <cerrno>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sequentialraii
+{
+template <class Context> class BlueprintInstance;
+
+namespace detail
+{
+/**
+ * Health check of a blueprint step, taking the instance's context, see verify().
+ */
+template <class Check>
+struct ContextCheck
+{
+    Check check;
+};
+
+template <class Check> struct IsStepOption<ContextCheck<Check>> : std::true_type {};
+
+/**
+ * Step of a blueprint, shared by all of its instances. The lambdas take the instance's context.
+ */
+template <class Context>
+class BlueprintStepBase
+{
+public:
+    virtual ~BlueprintStepBase() noexcept = default;
+
+    virtual bool init(Context& context, InitResult* result, const StopToken* stop) noexcept = 0;
+    virtual void uninit(Context& context) noexcept = 0;
+
+    const char* label = nullptr;
+    bool hasDependencies = false;
+    Dependencies dependencies;
+    bool hasRetryPolicy = false;
+    RetryPolicy retryPolicy;
+    bool hasAffinity = false;
+    Affinity affinity;
+    std::function<bool(Context&)> verify;
+};
+
+template <class Context, class Init, class Uninit>
+class BlueprintStep final : public BlueprintStepBase<Context>
+{
+public:
+    BlueprintStep(Init&& init_, Uninit&& uninit_)
+        : m_init(std::forward<Init>(init_))
+        , m_uninit(std::forward<Uninit>(uninit_))
+    {}
+
+    /**
+     * Same semantics as Step::init().
+     */
+    virtual bool init(Context& context, InitResult* result, const StopToken* stop) noexcept override
+    {
+        if (result)
+        {
+            errno = 0;
+        }
+
+        return runStoppableInit(m_init, result, stop, context);
+    }
+
+    virtual void uninit(Context& context) noexcept override
+    {
+        runUninit(m_uninit, context);
+    }
+
+private:
+    std::decay_t<Init> m_init;
+    std::decay_t<Uninit> m_uninit;
+};
+
+/**
+ * Step of an instance, binding a shared blueprint step to the instance's context. Two pointers,
+ * so instances of small blueprints keep all their steps inline.
+ */
+template <class Context>
+class BoundStep final : public StepBase
+{
+public:
+    BoundStep(BlueprintStepBase<Context>* step, Context* context) noexcept
+        : m_step(step)
+        , m_context(context)
+    {}
+
+    virtual bool init(InitResult* result, const StopToken* stop) noexcept override
+    {
+        return m_step->init(*m_context, result, stop);
+    }
+
+    virtual void uninit() noexcept override
+    {
+        m_step->uninit(*m_context);
+    }
+
+    virtual StepBase* relocate(unsigned char* oldBase, unsigned char* newBase) noexcept override
+    {
+        return detail::relocate(this, oldBase, newBase, std::true_type{});
+    }
+
+private:
+    BlueprintStepBase<Context>* m_step;
+    Context* m_context;
+};
+
+template <class Context>
+using BlueprintSteps = std::vector<std::unique_ptr<BlueprintStepBase<Context>>>;
+
+/**
+ * True if any of the options is inChunks(), which only ranges of steps take.
+ */
+template <class... Options>
+struct HasChunks : std::false_type {};
+
+template <class Option, class... Rest>
+struct HasChunks<Option, Rest...>
+    : std::integral_constant<bool, std::is_same<std::decay_t<Option>, Chunks>::value || HasChunks<Rest...>::value> {};
+
+} // Namespace detail
+
+/**
+ * Gives a new blueprint step a cheap check of whether what it initialized still works, like
+ * verify() does for a plain step. The check takes the instance's context, so that each instance
+ * checks its own resources, e.g. the connection of its own socket.
+ * Example: blueprint.addStep(connectFn, disconnectFn, verify([](Server& s) {return isConnected(s.fd);}));
+ */
+template <class Check, class = std::enable_if_t<!detail::IsNullaryCheck<std::decay_t<Check>>::value>>
+detail::ContextCheck<std::decay_t<Check>> verify(Check&& check)
+{
+    return detail::ContextCheck<std::decay_t<Check>>{std::forward<Check>(check)};
+}
+
+/**
+ * Describes a sequence once, so that any number of independent instances can be created from it
+ * without adding the steps again. Instead of capturing state by reference, the lambdas of a
+ * blueprint take a reference to a Context, of which every instance has its own:
+ * @code
+ *   SequenceBlueprint<Server> blueprint;
+ *   blueprint.addStep([](Server& s) {s.fd = socket(AF_INET, SOCK_DGRAM, 0); return s.fd >= 0;},
+ *                     [](Server& s) {close(s.fd);});
+ *   auto server = blueprint.instantiate();
+ *   server->sequence().initialize();
+ * @endcode
+ */
+template <class Context>
+class SequenceBlueprint
+{
+public:
+    SequenceBlueprint()
+        : m_steps(std::make_shared<detail::BlueprintSteps<Context>>())
+    {}
+
+    /**
+     * Adds a step to the blueprint, see SequentialRaii::addStep(). Takes the same options, which
+     * apply to every instance alike. For CPUs differing per instance, use setAffinity() on the
+     * instance's sequence instead. Health checks given with verify() take Context&, and each
+     * instance runs them on its own context. inChunks() is rejected, as blueprint steps aren't
+     * ranges.
+     * @param init Initialization lambda taking Context&, returning bool or std::error_code.
+     * @param uninit Uninitialization lambda taking Context&.
+     */
+    template <class Init, class Uninit, class... Options,
+              class = std::enable_if_t<!detail::IsStepOption<std::decay_t<Uninit>>::value>>
+    StepHandle addStep(Init&& init, Uninit&& uninit, const Options&... options)
+    {
+        static_assert(!detail::HasChunks<Options...>::value, "SequenceBlueprint: steps aren't ranges, inChunks() doesn't apply");
+
+        const std::size_t index = m_steps->size();
+        std::unique_ptr<detail::BlueprintStepBase<Context>> step(
+            new detail::BlueprintStep<Context, Init, Uninit>(std::forward<Init>(init), std::forward<Uninit>(uninit)));
+        recordOptions(*step, index, options...);
+
+        m_steps->push_back(std::move(step));
+        return StepHandle{index};
+    }
+
+    template <class Init, class... Options, class = std::enable_if_t<detail::AreStepOptions<Options...>::value>>
+    StepHandle addStep(Init&& init, const Options&... options)
+    {
+        return addStep(std::forward<Init>(init), [](Context&) {}, options...);
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_steps->size();
+    }
+
+    /**
+     * Creates an instance, not yet initialized. Its context and sequence share one allocation,
+     * together with the steps unless the blueprint has more than SequentialRaii keeps inline.
+     * The step code is shared with the blueprint and stays alive as long as any instance does.
+     * @param args Arguments for constructing the context.
+     */
+    template <class... Args>
+    std::unique_ptr<BlueprintInstance<Context>> instantiate(Args&&... args) const
+    {
+        std::unique_ptr<BlueprintInstance<Context>> instance(new BlueprintInstance<Context>(m_steps, std::forward<Args>(args)...));
+
+        SequentialRaii& sequence = instance->m_sequence;
+        sequence.reserve(m_steps->size(), sizeof(detail::BoundStep<Context>));
+        for (const auto& step : *m_steps)
+        {
+            const std::size_t index = sequence.m_steps.size();
+            if (step->hasDependencies)
+            {
+                sequence.prepareOption(index, step->dependencies);
+            }
+
+            if (step->hasRetryPolicy)
+            {
+                sequence.prepareOption(index, step->retryPolicy);
+            }
+
+            if (step->hasAffinity)
+            {
+                sequence.prepareOption(index, step->affinity);
+            }
+
+            // Binds the shared check to this instance's context.
+            Verify verify;
+            if (step->verify)
+            {
+                const detail::BlueprintStepBase<Context>* shared = step.get();
+                Context* context = &instance->m_context;
+                verify.check = std::make_shared<const std::function<bool()>>(
+                    [shared, context]() {return shared->verify(*context);});
+                sequence.prepareOption(index, verify);
+            }
+
+            StepBase* bound = sequence.m_steps.emplace<detail::BoundStep<Context>>(step.get(), &instance->m_context);
+            bound->setLabel(step->label);
+            if (step->hasDependencies)
+            {
+                sequence.applyOption(*bound, index, step->dependencies);
+            }
+
+            if (step->hasRetryPolicy)
+            {
+                sequence.applyOption(*bound, index, step->retryPolicy);
+            }
+
+            if (step->hasAffinity)
+            {
+                sequence.applyOption(*bound, index, step->affinity);
+            }
+
+            if (verify.check)
+            {
+                sequence.applyOption(*bound, index, verify);
+            }
+        }
+
+        return instance;
+    }
+
+private:
+    void recordOptions(detail::BlueprintStepBase<Context>&, std::size_t) noexcept
+    {}
+
+    template <class Option, class... Rest>
+    void recordOptions(detail::BlueprintStepBase<Context>& step, std::size_t index, const Option& option, const Rest&... rest)
+    {
+        recordOption(step, index, option);
+        recordOptions(step, index, rest...);
+    }
+
+    void recordOption(detail::BlueprintStepBase<Context>& step, std::size_t index, const Dependencies& dependencies)
+    {
+        for (const StepHandle& dependency : dependencies.steps)
+        {
+            if (dependency.index >= index)
+            {
+                SEQRAII_THROW(std::invalid_argument("SequenceBlueprint: dependency on unknown step"));
+            }
+        }
+
+        step.hasDependencies = true;
+        step.dependencies = dependencies;
+    }
+
+    void recordOption(detail::BlueprintStepBase<Context>& step, std::size_t, const Label& name) noexcept
+    {
+        step.label = name.name;
+    }
+
+    void recordOption(detail::BlueprintStepBase<Context>& step, std::size_t, const RetryPolicy& policy) noexcept
+    {
+        step.hasRetryPolicy = true;
+        step.retryPolicy = policy;
+    }
+
+    void recordOption(detail::BlueprintStepBase<Context>& step, std::size_t, const Affinity& affinity) noexcept
+    {
+        step.hasAffinity = true;
+        step.affinity = affinity;
+    }
+
+    void recordOption(detail::BlueprintStepBase<Context>& step, std::size_t, const Verify& check)
+    {
+        std::shared_ptr<const std::function<bool()>> shared = check.check;
+        step.verify = [shared](Context&) {return (*shared)();};
+    }
+
+    template <class Check>
+    void recordOption(detail::BlueprintStepBase<Context>& step, std::size_t, const detail::ContextCheck<Check>& check)
+    {
+        step.verify = check.check;
+    }
+
+    std::shared_ptr<detail::BlueprintSteps<Context>> m_steps;
+};
+
+/**
+ * Instance of a SequenceBlueprint: the context together with the sequence of steps bound to it.
+ * Not movable, since the steps refer to the context. Uninitialized when destroyed.
+ */
+template <class Context>
+class BlueprintInstance
+{
+public:
+    BlueprintInstance(const BlueprintInstance&) = delete;
+    BlueprintInstance& operator=(const BlueprintInstance&) = delete;
+
+    Context& context() noexcept
+    {
+        return m_context;
+    }
+
+    const Context& context() const noexcept
+    {
+        return m_context;
+    }
+
+    SequentialRaii& sequence() noexcept
+    {
+        return m_sequence;
+    }
+
+    const SequentialRaii& sequence() const noexcept
+    {
+        return m_sequence;
+    }
+
+private:
+    friend class SequenceBlueprint<Context>;
+
+    template <class... Args>
+    BlueprintInstance(std::shared_ptr<detail::BlueprintSteps<Context>> steps, Args&&... args)
+        : m_steps(std::move(steps))
+        , m_context(std::forward<Args>(args)...)
+    {}
+
+    // Declared in this order so that the steps are uninitialized before the context and the
+    // step code go away.
+    std::shared_ptr<detail::BlueprintSteps<Context>> m_steps;
+    Context m_context;
+    SequentialRaii m_sequence;
+};
+
+} // Namespace sequentialraii
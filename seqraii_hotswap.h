@@ -0,0 +1,270 @@
+/**
+ * Blue/green replacement of a resource built with SequentialRaii, without a moment in which none
+ * exists.
+ *
+ * License: MIT license. See separate file for full disclaimer.
+ * Compile with C++14 enabled.
+ */
+#pragma once
+
+#include "seqraii.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace sequentialraii
+{
+/**
+ * Holds the live generation of a resource of type T, brought up by its own SequentialRaii, and
+ * replaces it without a gap: replace() builds and initializes the next generation next to the live
+ * one, publishes it atomically, waits for the readers still using the old one and only then tears
+ * the old one down. A replacement that fails to initialize is rolled back and the live generation
+ * stays in place.
+ *
+ * There are two slots, blue and green, each with a reader count. A reader announces itself on the
+ * slot it found live and checks that the slot is still live, so a generation is torn down only once
+ * its count has dropped to zero after it was unpublished. Reading takes no lock, but readers share
+ * the count of a slot, so read() suits taking a resource per request or per batch rather than per
+ * byte. T must be default constructible. All readers must be gone before the HotSwap is destroyed.
+ */
+template <class T>
+class HotSwap
+{
+    struct Generation;
+
+public:
+    /// Adds the steps bringing up one generation. The steps may keep references to the resource.
+    using Builder = std::function<void(SequentialRaii&, T&)>;
+
+    /**
+     * Access to the generation that was live when read() was called, keeping it alive until the
+     * reader goes away.
+     */
+    class Reader
+    {
+    public:
+        Reader() noexcept = default;
+
+        Reader(Reader&& rhs) noexcept
+            : m_readers(std::exchange(rhs.m_readers, nullptr))
+            , m_value(std::exchange(rhs.m_value, nullptr))
+        {}
+
+        Reader& operator=(Reader&& rhs) noexcept
+        {
+            if (this != &rhs)
+            {
+                release();
+                m_readers = std::exchange(rhs.m_readers, nullptr);
+                m_value = std::exchange(rhs.m_value, nullptr);
+            }
+
+            return *this;
+        }
+
+        ~Reader() noexcept
+        {
+            release();
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_value != nullptr;
+        }
+
+        const T& operator*() const noexcept
+        {
+            return *m_value;
+        }
+
+        const T* operator->() const noexcept
+        {
+            return m_value;
+        }
+
+        void release() noexcept
+        {
+            if (m_readers)
+            {
+                m_readers->fetch_sub(1, std::memory_order_release);
+                m_readers = nullptr;
+                m_value = nullptr;
+            }
+        }
+
+    private:
+        friend class HotSwap;
+
+        Reader(std::atomic<unsigned>* readers, const T* value) noexcept
+            : m_readers(readers)
+            , m_value(value)
+        {}
+
+        std::atomic<unsigned>* m_readers = nullptr;
+        const T* m_value = nullptr;
+    };
+
+    /**
+     * @param reaper Optional reaper tearing down replaced generations, see SequentialRaii::retireAsync().
+     *               Without one replace() tears them down itself.
+     */
+    explicit HotSwap(Reaper* reaper = nullptr) noexcept
+        : m_reaper(reaper)
+    {}
+
+    ~HotSwap() noexcept
+    {
+        for (Slot& slot : m_slots)
+        {
+            if (slot.generation)
+            {
+                retire(*slot.generation);
+            }
+        }
+    }
+
+    HotSwap(const HotSwap&) = delete;
+    HotSwap& operator=(const HotSwap&) = delete;
+
+    /**
+     * @return Reader of the live generation, empty if none was published yet.
+     */
+    Reader read() const noexcept
+    {
+        while (true)
+        {
+            const int live = m_live.load(std::memory_order_seq_cst);
+            if (live < 0)
+            {
+                return Reader();
+            }
+
+            // Announce first, then check that the slot is still live. replace() unpublishes first,
+            // then checks the count, so one of the two sees the other.
+            Slot& slot = m_slots[live];
+            slot.readers.fetch_add(1, std::memory_order_seq_cst);
+            if (m_live.load(std::memory_order_seq_cst) == live)
+            {
+                return Reader(&slot.readers, slot.generation->value.get());
+            }
+
+            slot.readers.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    /**
+     * Builds and initializes the next generation while the live one keeps serving, then swaps them.
+     * Blocks until the readers of the old generation are gone. Replacements are serialized.
+     * @param result Receives the details if the new generation failed to initialize.
+     * @return False if the new generation failed to initialize. It is rolled back and the live
+     *         generation is kept.
+     */
+    bool replace(const Builder& build, InitResult* result = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const int live = m_live.load(std::memory_order_relaxed);
+        Slot& next = m_slots[live == 0 ? 1 : 0];
+
+        std::unique_ptr<Generation> generation(new Generation());
+        generation->value = std::make_shared<T>();
+        if (m_reaper)
+        {
+            // Torn down on the reaper after the generation is gone, so the first step keeps the
+            // resource alive until the sequence itself is destroyed.
+            std::shared_ptr<T> value = generation->value;
+            generation->sequence.addStep([]() {return true;}, [value]() {});
+        }
+
+        build(generation->sequence, *generation->value);
+        InitResult details;
+        if (!generation->sequence.initialize(details))
+        {
+            if (result)
+            {
+                *result = details;
+            }
+
+            return false;
+        }
+
+        // Only the live slot is read, so the other one may be filled without the readers noticing.
+        next.generation = std::move(generation);
+        m_live.store(live == 0 ? 1 : 0, std::memory_order_seq_cst);
+        m_generation.fetch_add(1, std::memory_order_relaxed);
+
+        if (live >= 0)
+        {
+            Slot& old = m_slots[live];
+            waitForReaders(old);
+            retire(*old.generation);
+            old.generation.reset();
+        }
+
+        return true;
+    }
+
+    /**
+     * @return Number of generations published so far, counting in a replacement as soon as it is
+     *         published, while its predecessor may still be draining.
+     */
+    std::size_t generation() const noexcept
+    {
+        return m_generation.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Generation
+    {
+        // Declared before the sequence, so that the steps are torn down while it still exists.
+        std::shared_ptr<T> value;
+        SequentialRaii sequence;
+    };
+
+    struct Slot
+    {
+        std::unique_ptr<Generation> generation;
+        mutable std::atomic<unsigned> readers{0};
+    };
+
+    static void waitForReaders(const Slot& slot) noexcept
+    {
+        for (unsigned spins = 0; slot.readers.load(std::memory_order_seq_cst) != 0; ++spins)
+        {
+            if (spins < 64)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+
+    void retire(Generation& generation) noexcept
+    {
+        if (m_reaper)
+        {
+            generation.sequence.retireAsync(*m_reaper);
+        }
+        else
+        {
+            generation.sequence.uninitialize();
+        }
+    }
+
+    Reaper* m_reaper;
+
+    // Blue and green, and which of them readers are sent to, -1 before the first publish.
+    mutable Slot m_slots[2];
+    std::atomic<int> m_live{-1};
+    std::atomic<std::size_t> m_generation{0};
+    std::mutex m_mutex;
+};
+
+} // Namespace sequentialraii
@@ -0,0 +1,451 @@
+/**
+ * Pool of pre-initialized resources built with SequentialRaii.
+ *
+ * License: MIT license. See separate file for full disclaimer.
+ * Compile with C++14 enabled.
+ */
+#pragma once
+
+#include "seqraii.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace sequentialraii
+{
+namespace detail
+{
+/**
+ * Bounded multi-producer multi-consumer queue. Every cell carries a sequence number telling
+ * producers and consumers whose turn it is, so neither side takes a lock.
+ */
+template <class T>
+class BoundedQueue
+{
+public:
+    /**
+     * @param capacity Minimum number of elements, rounded up to a power of two.
+     */
+    explicit BoundedQueue(std::size_t capacity)
+    {
+        std::size_t size = 1;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+
+        m_cells.reset(new Cell[size]);
+        m_mask = size - 1;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @return False if the queue is full.
+     */
+    bool push(T value) noexcept
+    {
+        std::size_t position = m_enqueue.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = m_cells[position & m_mask];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if (diff == 0)
+            {
+                if (m_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = m_enqueue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @return False if the queue is empty.
+     */
+    bool pop(T& value) noexcept
+    {
+        std::size_t position = m_dequeue.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = m_cells[position & m_mask];
+            const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+            if (diff == 0)
+            {
+                if (m_dequeue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = m_dequeue.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::size_t m_mask = 0;
+
+    // Producers and consumers on separate cache lines.
+    alignas(64) std::atomic<std::size_t> m_enqueue{0};
+    alignas(64) std::atomic<std::size_t> m_dequeue{0};
+};
+
+} // Namespace detail
+
+/**
+ * Keeps a number of resources of type T warm, each brought up by its own SequentialRaii, and hands
+ * them out without taking a lock. A returned resource is recycled with the optional reset
+ * function; if that fails the resource is uninitialized and initialized again on a background
+ * thread. The same thread adds resources, up to a maximum, when the number of available ones drops
+ * below a low-water mark.
+ *
+ * T must be default constructible. All leases must be returned before the pool is destroyed.
+ */
+template <class T>
+class SequentialRaiiPool
+{
+    struct Slot;
+
+public:
+    /// Adds the steps bringing up one resource. The steps may keep references to the resource.
+    using Builder = std::function<void(SequentialRaii&, T&)>;
+
+    /// Makes a returned resource ready for the next user, returns false if it has to be rebuilt.
+    using Reset = std::function<bool(T&)>;
+
+    /**
+     * Resource handed out by acquire(), returned to the pool when the lease goes away.
+     */
+    class Lease
+    {
+    public:
+        Lease() noexcept = default;
+
+        Lease(Lease&& rhs) noexcept
+            : m_pool(std::exchange(rhs.m_pool, nullptr))
+            , m_slot(std::exchange(rhs.m_slot, nullptr))
+        {}
+
+        Lease& operator=(Lease&& rhs) noexcept
+        {
+            if (this != &rhs)
+            {
+                release();
+                m_pool = std::exchange(rhs.m_pool, nullptr);
+                m_slot = std::exchange(rhs.m_slot, nullptr);
+            }
+
+            return *this;
+        }
+
+        ~Lease() noexcept
+        {
+            release();
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_slot != nullptr;
+        }
+
+        T& operator*() const noexcept
+        {
+            return m_slot->value;
+        }
+
+        T* operator->() const noexcept
+        {
+            return &m_slot->value;
+        }
+
+        /**
+         * Returns the resource to the pool ahead of time.
+         */
+        void release() noexcept
+        {
+            if (m_slot)
+            {
+                m_pool->release(m_slot);
+                m_slot = nullptr;
+            }
+        }
+
+    private:
+        friend class SequentialRaiiPool;
+
+        Lease(SequentialRaiiPool* pool, Slot* slot) noexcept
+            : m_pool(pool)
+            , m_slot(slot)
+        {}
+
+        SequentialRaiiPool* m_pool = nullptr;
+        Slot* m_slot = nullptr;
+    };
+
+    /**
+     * Builds and initializes the initial resources, then starts the background thread.
+     * @param size Number of resources to create up front.
+     * @param build Adds the steps of one resource.
+     * @param reset Optional cheap recycling step. Without one, returned resources are reused as is.
+     * @param maxSize Upper limit the background thread may grow the pool to, at least size.
+     * @param lowWatermark The pool grows when fewer resources than this are available.
+     */
+    SequentialRaiiPool(std::size_t size, Builder build, Reset reset = Reset(), std::size_t maxSize = 0, std::size_t lowWatermark = 0)
+        : m_build(std::move(build))
+        , m_reset(std::move(reset))
+        , m_maxSize(maxSize > size ? maxSize : size)
+        , m_lowWatermark(lowWatermark)
+        , m_available(m_maxSize)
+    {
+        m_slots.reserve(m_maxSize);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            Slot* slot = addSlot();
+            if (slot->sequence.initialize())
+            {
+                push(slot);
+            }
+            else
+            {
+                m_dirty.push_back(slot);
+            }
+        }
+
+        m_thread = std::thread([this]() {replenish();});
+    }
+
+    ~SequentialRaiiPool() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+
+        m_wakeup.notify_one();
+        m_thread.join();
+    }
+
+    SequentialRaiiPool(const SequentialRaiiPool&) = delete;
+    SequentialRaiiPool& operator=(const SequentialRaiiPool&) = delete;
+
+    /**
+     * Takes an initialized resource out of the pool.
+     * @return Lease for the resource, empty if none is available right now.
+     */
+    Lease acquire() noexcept
+    {
+        Slot* slot = nullptr;
+        if (!m_available.pop(slot))
+        {
+            m_wakeup.notify_one();
+            return Lease();
+        }
+
+        if (m_count.fetch_sub(1, std::memory_order_relaxed) <= m_lowWatermark)
+        {
+            m_wakeup.notify_one();
+        }
+
+        return Lease(this, slot);
+    }
+
+    /**
+     * @return Number of resources ready to be acquired.
+     */
+    std::size_t available() const noexcept
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return Number of resources the pool owns, whether available, leased or being rebuilt.
+     */
+    std::size_t size() const noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_slots.size();
+    }
+
+private:
+    struct Slot
+    {
+        // Declared before the sequence, so that the steps are torn down while it still exists.
+        T value;
+        SequentialRaii sequence;
+    };
+
+    /// How often the background thread checks for work it might not have been woken up for.
+    static constexpr std::chrono::milliseconds kPollInterval{100};
+
+    Slot* addSlot()
+    {
+        std::unique_ptr<Slot> slot(new Slot());
+        m_build(slot->sequence, slot->value);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slots.push_back(std::move(slot));
+        return m_slots.back().get();
+    }
+
+    void push(Slot* slot) noexcept
+    {
+        // Counted first so that the count never drops below zero in acquire(). Never fails, the
+        // queue has room for every slot.
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_available.push(slot);
+    }
+
+    void release(Slot* slot) noexcept
+    {
+        bool clean = true;
+        if (m_reset)
+        {
+            SEQRAII_TRY
+            {
+                clean = m_reset(slot->value);
+            }
+            SEQRAII_CATCH_ALL
+            {
+                clean = false;
+            }
+        }
+
+        if (clean)
+        {
+            push(slot);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_dirty.push_back(slot);
+        }
+
+        m_wakeup.notify_one();
+    }
+
+    bool needsGrowth() const noexcept
+    {
+        return m_count.load(std::memory_order_relaxed) < m_lowWatermark && m_slots.size() < m_maxSize;
+    }
+
+    /**
+     * Background thread rebuilding returned resources and growing the pool.
+     */
+    void replenish() noexcept
+    {
+        std::vector<Slot*> dirty;
+        std::vector<Slot*> failed;
+        while (true)
+        {
+            bool grow = false;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wakeup.wait_for(lock, kPollInterval, [this]() {return m_stopping || !m_dirty.empty() || needsGrowth();});
+                if (m_stopping)
+                {
+                    return;
+                }
+
+                dirty.swap(m_dirty);
+                grow = needsGrowth();
+            }
+
+            // Slots that failed last time are retried only every poll interval.
+            dirty.insert(dirty.end(), failed.begin(), failed.end());
+            failed.clear();
+            for (Slot* slot : dirty)
+            {
+                slot->sequence.uninitialize();
+                if (slot->sequence.initialize())
+                {
+                    push(slot);
+                }
+                else
+                {
+                    failed.push_back(slot);
+                }
+            }
+
+            dirty.clear();
+            if (grow)
+            {
+                SEQRAII_TRY
+                {
+                    Slot* slot = addSlot();
+                    if (slot->sequence.initialize())
+                    {
+                        push(slot);
+                    }
+                    else
+                    {
+                        failed.push_back(slot);
+                    }
+                }
+                SEQRAII_CATCH_ALL
+                {
+                }
+            }
+        }
+    }
+
+    Builder m_build;
+    Reset m_reset;
+    const std::size_t m_maxSize;
+    const std::size_t m_lowWatermark;
+
+    detail::BoundedQueue<Slot*> m_available;
+    std::atomic<std::size_t> m_count{0};
+
+    /// Owns every slot, guarded by m_mutex.
+    std::vector<std::unique_ptr<Slot>> m_slots;
+
+    /// Returned slots waiting to be rebuilt, guarded by m_mutex.
+    std::vector<Slot*> m_dirty;
+    bool m_stopping = false;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::thread m_thread;
+};
+
+template <class T>
+constexpr std::chrono::milliseconds SequentialRaiiPool<T>::kPollInterval;
+
+} // Namespace sequentialraii
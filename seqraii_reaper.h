@@ -0,0 +1,161 @@
+/**
+ * Background thread uninitializing retired sequences, off the latency-critical path.
+ *
+ * License: MIT license. See separate file for full disclaimer.
+ * Compile with C++14 enabled.
+ */
+#pragma once
+
+#include "seqraii.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace sequentialraii
+{
+/**
+ * Reaper with a thread of its own, uninitializing and destroying retired sequences one by one in
+ * the order they were retired. The backlog is bounded: once it is full, retiring either waits for
+ * room or uninitializes the sequence on the calling thread, so that deferred work can't pile up
+ * faster than it is done. Everything retired is uninitialized before the reaper is destroyed.
+ */
+class BackgroundReaper final : public Reaper
+{
+public:
+    /// What retiring does when the backlog is full.
+    enum class Overflow
+    {
+        kWait,      ///< Block until the reaper has made room.
+        kInline     ///< Uninitialize on the calling thread.
+    };
+
+    /**
+     * @param maxBacklog Number of sequences that may wait to be uninitialized, at least 1.
+     * @param overflow What to do when that many are waiting.
+     */
+    explicit BackgroundReaper(std::size_t maxBacklog = 1024, Overflow overflow = Overflow::kWait)
+        : m_maxBacklog(maxBacklog > 0 ? maxBacklog : 1)
+        , m_overflow(overflow)
+        , m_thread([this]() {run();})
+    {}
+
+    /**
+     * Uninitializes the remaining backlog, then stops the thread.
+     */
+    ~BackgroundReaper() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+
+        m_work.notify_one();
+        m_thread.join();
+    }
+
+    BackgroundReaper(const BackgroundReaper&) = delete;
+    BackgroundReaper& operator=(const BackgroundReaper&) = delete;
+
+    /**
+     * Takes the steps of the sequence. With a full backlog, waits for room or uninitializes them
+     * right away, depending on the overflow policy. Either way the sequence is left empty.
+     */
+    virtual bool retire(SequentialRaii& sequence) noexcept override
+    {
+        // Moved before taking the lock, which only guards the queue itself.
+        SequentialRaii retired(std::move(sequence));
+        retired.setReaper(nullptr);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_backlog.size() >= m_maxBacklog)
+        {
+            if (m_overflow == Overflow::kInline)
+            {
+                lock.unlock();
+                retired.uninitialize();
+                return true;
+            }
+
+            m_room.wait(lock, [this]() {return m_backlog.size() < m_maxBacklog;});
+        }
+
+        SEQRAII_TRY
+        {
+            m_backlog.push_back(std::move(retired));
+        }
+        SEQRAII_CATCH_ALL
+        {
+            lock.unlock();
+            retired.uninitialize();
+            return true;
+        }
+
+        lock.unlock();
+        m_work.notify_one();
+        return true;
+    }
+
+    /**
+     * Blocks until everything retired so far has been uninitialized.
+     */
+    void drain() noexcept
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_room.wait(lock, [this]() {return m_backlog.empty() && !m_busy;});
+    }
+
+    /**
+     * @return Number of sequences waiting to be uninitialized.
+     */
+    std::size_t backlog() const noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_backlog.size();
+    }
+
+private:
+    void run() noexcept
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_work.wait(lock, [this]() {return m_stopping || !m_backlog.empty();});
+            if (m_backlog.empty())
+            {
+                return;
+            }
+
+            {
+                SequentialRaii retired(std::move(m_backlog.front()));
+                m_backlog.pop_front();
+                m_busy = true;
+                lock.unlock();
+
+                // Uninitialized and destroyed, memory freed and all, without holding the lock.
+                retired.uninitialize();
+            }
+
+            lock.lock();
+            m_busy = false;
+            m_room.notify_all();
+        }
+    }
+
+    const std::size_t m_maxBacklog;
+    const Overflow m_overflow;
+
+    /// Retired sequences, oldest first, and whether one is being uninitialized. Guarded by m_mutex.
+    std::deque<SequentialRaii> m_backlog;
+    bool m_busy = false;
+    bool m_stopping = false;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_work;
+    std::condition_variable m_room;
+    std::thread m_thread;
+};
+
+} // Namespace sequentialraii
@@ -0,0 +1,240 @@
+/**
+ * Reports of the step timings recorded by a StepTimer: a Chrome trace of every step, and a text
+ * summary ranking the steps and marking the critical path through the dependency graph.
+ *
+ * License: MIT license. See separate file for full disclaimer.
+ * Compile with C++14 enabled.
+ */
+#pragma once
+
+#include "seqraii.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <iomanip>
+#include <ios>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sequentialraii
+{
+namespace detail
+{
+inline bool hasRun(const StepTimer::Timing& timing) noexcept
+{
+    return timing.initBegin != StepTimer::Clock::time_point{};
+}
+
+inline std::string stepName(const StepTimer::Timing& timing, std::size_t index)
+{
+    return timing.label ? std::string(timing.label) : "step " + std::to_string(index);
+}
+
+inline double toMicroseconds(StepTimer::Clock::duration duration) noexcept
+{
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+inline void writeJsonString(std::ostream& out, const std::string& text)
+{
+    out << '"';
+    for (const char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+            out << escaped;
+        }
+        else
+        {
+            out << c;
+        }
+    }
+
+    out << '"';
+}
+
+/**
+ * Numbers threads in the order they are first seen, for readable trace thread ids.
+ */
+class ThreadNumbers
+{
+public:
+    std::size_t operator()(std::thread::id id)
+    {
+        auto it = std::find(m_ids.begin(), m_ids.end(), id);
+        if (it != m_ids.end())
+        {
+            return static_cast<std::size_t>(it - m_ids.begin()) + 1;
+        }
+
+        m_ids.push_back(id);
+        return m_ids.size();
+    }
+
+private:
+    std::vector<std::thread::id> m_ids;
+};
+
+} // Namespace detail
+
+/**
+ * Writes the last initialization and uninitialization of every step as Chrome trace events, one
+ * complete ("X") event per step and phase, on the thread that ran it. Load the output in
+ * chrome://tracing or ui.perfetto.dev. Times are relative to the earliest recorded event, in
+ * microseconds with nanosecond digits however long the sequence took.
+ */
+inline void writeChromeTrace(std::ostream& out, const StepTimer& timer)
+{
+    const auto& timings = timer.timings();
+    StepTimer::Clock::time_point origin = StepTimer::Clock::time_point::max();
+    for (const auto& timing : timings)
+    {
+        if (detail::hasRun(timing))
+        {
+            origin = std::min(origin, timing.initBegin);
+        }
+    }
+
+    // The default six significant digits would round anything past a second to ten microseconds.
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    detail::ThreadNumbers threads;
+    bool first = true;
+    auto writeEvent =
+        [&](const StepTimer::Timing& timing, std::size_t index, const char* phase, StepTimer::Clock::time_point begin,
+            StepTimer::Clock::duration duration, std::thread::id thread)
+        {
+            out << (first ? "\n" : ",\n") << "{\"name\":";
+            detail::writeJsonString(out, detail::stepName(timing, index));
+            out << ",\"cat\":\"" << phase << "\",\"ph\":\"X\",\"ts\":" << detail::toMicroseconds(begin - origin)
+                << ",\"dur\":" << detail::toMicroseconds(duration) << ",\"pid\":1,\"tid\":" << threads(thread)
+                << ",\"args\":{\"step\":" << index << ",\"failed\":" << (timing.failed ? "true" : "false") << "}}";
+            first = false;
+        };
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (std::size_t i = 0; i < timings.size(); ++i)
+    {
+        const auto& timing = timings[i];
+        if (!detail::hasRun(timing))
+        {
+            continue;
+        }
+
+        writeEvent(timing, i, "init", timing.initBegin, timing.initDuration, timing.initThread);
+        if (timing.uninitThread != std::thread::id())
+        {
+            writeEvent(timing, i, "uninit", timing.uninitBegin, timing.uninitDuration, timing.uninitThread);
+        }
+    }
+
+    out << "\n]}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+/**
+ * Finds the chain of dependent steps taking longest to initialize, which bounds how fast the
+ * sequence can come up however many threads initialize it.
+ * @return Indices of the steps on the path, in initialization order.
+ */
+inline std::vector<std::size_t> criticalPath(const StepTimer& timer, const SequentialRaii& sequence)
+{
+    const auto& timings = timer.timings();
+    const std::size_t count = std::min(timings.size(), sequence.size());
+
+    // Dependencies always point backwards, so the steps are already in topological order.
+    const std::size_t none = static_cast<std::size_t>(-1);
+    std::vector<StepTimer::Clock::duration> finish(count, StepTimer::Clock::duration::zero());
+    std::vector<std::size_t> previous(count, none);
+    std::size_t last = none;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        StepTimer::Clock::duration start = StepTimer::Clock::duration::zero();
+        for (const std::size_t dependency : sequence.dependencies(i))
+        {
+            if (dependency < count && finish[dependency] > start)
+            {
+                start = finish[dependency];
+                previous[i] = dependency;
+            }
+        }
+
+        finish[i] = start + (detail::hasRun(timings[i]) ? timings[i].initDuration : StepTimer::Clock::duration::zero());
+        if (last == none || finish[i] > finish[last])
+        {
+            last = i;
+        }
+    }
+
+    std::vector<std::size_t> path;
+    for (std::size_t i = last; i != none; i = previous[i])
+    {
+        path.push_back(i);
+    }
+
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+/**
+ * Writes the steps ranked by initialization time, with their share of the total and their
+ * uninitialization time. Steps on the critical path are marked with '*'.
+ */
+inline void writeSummary(std::ostream& out, const StepTimer& timer, const SequentialRaii& sequence)
+{
+    const auto& timings = timer.timings();
+    const std::vector<std::size_t> path = criticalPath(timer, sequence);
+
+    std::vector<std::size_t> ranked;
+    StepTimer::Clock::duration total = StepTimer::Clock::duration::zero();
+    StepTimer::Clock::duration critical = StepTimer::Clock::duration::zero();
+    for (std::size_t i = 0; i < timings.size(); ++i)
+    {
+        if (detail::hasRun(timings[i]))
+        {
+            ranked.push_back(i);
+            total += timings[i].initDuration;
+        }
+    }
+
+    for (const std::size_t i : path)
+    {
+        critical += timings[i].initDuration;
+    }
+
+    std::stable_sort(ranked.begin(), ranked.end(),
+        [&](std::size_t a, std::size_t b) {return timings[a].initDuration > timings[b].initDuration;});
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-4s %6s  %-32s %12s %7s %12s\n", "", "step", "label", "init us", "share", "uninit us");
+    out << line;
+    for (const std::size_t i : ranked)
+    {
+        const auto& timing = timings[i];
+        const bool onPath = std::find(path.begin(), path.end(), i) != path.end();
+        const double share = total.count() > 0 ? 100.0 * timing.initDuration.count() / total.count() : 0.0;
+        std::snprintf(line, sizeof(line), "%-4s %6zu  %-32.32s %12.1f %6.1f%% %12.1f%s\n", onPath ? "*" : "", i,
+                      detail::stepName(timing, i).c_str(), detail::toMicroseconds(timing.initDuration), share,
+                      detail::toMicroseconds(timing.uninitDuration), timing.failed ? "  failed" : "");
+        out << line;
+    }
+
+    std::snprintf(line, sizeof(line), "total %.1f us, critical path %.1f us over %zu steps\n",
+                  detail::toMicroseconds(total), detail::toMicroseconds(critical), path.size());
+    out << line;
+}
+
+} // Namespace sequentialraii
@@ -0,0 +1,155 @@
+/**
+ * SequentialRaii shared between threads, initialized by whichever thread needs it first.
+ *
+ * License: MIT license. See separate file for full disclaimer.
+ * Compile with C++14 enabled.
+ */
+#pragma once
+
+#include "seqraii.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+namespace sequentialraii
+{
+/**
+ * Wraps a SequentialRaii so that any number of threads may call initialize() and uninitialize()
+ * concurrently. The first caller runs the steps while the others block until it is done and share
+ * its result, like std::call_once. A failed attempt is made again by the next caller. Once the
+ * sequence is initialized, initialize() is a single acquire load.
+ *
+ * uninitialize() waits for a running initialization to finish. Threads still using the resources
+ * when uninitialize() is called must be stopped by other means.
+ */
+class SharedSequentialRaii
+{
+public:
+    /**
+     * @param sequence Fully built sequence. Steps can't be added once it's shared.
+     */
+    explicit SharedSequentialRaii(SequentialRaii sequence) noexcept
+        : m_sequence(std::move(sequence))
+    {}
+
+    ~SharedSequentialRaii() noexcept
+    {
+        uninitialize();
+    }
+
+    SharedSequentialRaii(const SharedSequentialRaii&) = delete;
+    SharedSequentialRaii& operator=(const SharedSequentialRaii&) = delete;
+
+    /**
+     * Initializes the sequence unless it already is, or waits for the thread initializing it.
+     * @return True if the sequence is initialized, false if the attempt this call ran or waited
+     *         for failed.
+     */
+    bool initialize() noexcept
+    {
+        if (m_state.load(std::memory_order_acquire) == kInitialized)
+        {
+            return true;
+        }
+
+        return initializeSlow(nullptr);
+    }
+
+    /**
+     * Like initialize(), reporting the details of a failure, see SequentialRaii::initialize(InitResult&).
+     * Threads that waited receive the result of the thread that ran the steps.
+     */
+    bool initialize(InitResult& result) noexcept
+    {
+        result = InitResult{};
+        if (m_state.load(std::memory_order_acquire) == kInitialized)
+        {
+            return true;
+        }
+
+        return initializeSlow(&result);
+    }
+
+    /**
+     * Uninitializes the sequence in reverse order, after waiting for a running initialization.
+     */
+    void uninitialize() noexcept
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this]() {return m_state.load(std::memory_order_relaxed) != kInitializing;});
+        if (m_state.load(std::memory_order_relaxed) == kInitialized)
+        {
+            // New callers block on the mutex until the steps are torn down.
+            m_state.store(kIdle, std::memory_order_relaxed);
+            m_sequence.uninitialize();
+        }
+    }
+
+    bool initialized() const noexcept
+    {
+        return m_state.load(std::memory_order_acquire) == kInitialized;
+    }
+
+private:
+    enum State : int
+    {
+        kIdle,
+        kInitializing,
+        kInitialized
+    };
+
+    bool initializeSlow(InitResult* result) noexcept
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_state.load(std::memory_order_relaxed) == kInitializing)
+        {
+            // Share the outcome of the running attempt.
+            const std::uint64_t attempt = m_attempt;
+            m_done.wait(lock, [this, attempt]() {return m_attempt != attempt;});
+            if (result)
+            {
+                *result = m_lastResult;
+            }
+
+            return m_state.load(std::memory_order_relaxed) == kInitialized;
+        }
+
+        if (m_state.load(std::memory_order_relaxed) == kInitialized)
+        {
+            return true;
+        }
+
+        m_state.store(kInitializing, std::memory_order_relaxed);
+        lock.unlock();
+
+        InitResult attemptResult;
+        const bool success = m_sequence.initialize(attemptResult);
+
+        lock.lock();
+        m_lastResult = std::move(attemptResult);
+        if (result)
+        {
+            *result = m_lastResult;
+        }
+
+        ++m_attempt;
+        m_state.store(success ? kInitialized : kIdle, std::memory_order_release);
+        lock.unlock();
+        m_done.notify_all();
+        return success;
+    }
+
+    SequentialRaii m_sequence;
+    std::atomic<State> m_state{kIdle};
+
+    /// Number of finished initialization attempts, lets waiters tell theirs has finished.
+    std::uint64_t m_attempt = 0;
+    InitResult m_lastResult;
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+};
+
+} // Namespace sequentialraii
@@ -0,0 +1,292 @@
+/**
+ * Ready-made steps for the resources of latency-critical Linux services: pre-faulted and locked
+ * memory, socket buffers, busy polling, CPU pinning, eventfds and epoll. Each adds one step to a
+ * SequentialRaii and reports errno through InitResult on failure.
+ *
+ * License: MIT license. See separate file for full disclaimer.
+ * Compile with C++14 enabled.
+ */
+#pragma once
+
+#include "seqraii.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <type_traits>
+
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sequentialraii
+{
+namespace detail
+{
+/**
+ * @return Empty error code on success, errno otherwise.
+ */
+inline std::error_code errnoUnless(bool success) noexcept
+{
+    return success ? std::error_code() : std::error_code(errno, std::system_category());
+}
+
+/**
+ * Sets a socket buffer size and checks what the kernel made of it. Linux caps the requested size
+ * at the rmem_max or wmem_max sysctl, then doubles it to account for its bookkeeping, so the size
+ * read back is below twice the requested one exactly when the cap was hit. The forcing variant
+ * ignores the cap, but only with CAP_NET_ADMIN.
+ */
+inline std::error_code setBufferSize(int fd, int option, int forceOption, int bytes) noexcept
+{
+    if (setsockopt(fd, SOL_SOCKET, forceOption, &bytes, sizeof(bytes)) != 0 &&
+        setsockopt(fd, SOL_SOCKET, option, &bytes, sizeof(bytes)) != 0)
+    {
+        return std::error_code(errno, std::system_category());
+    }
+
+    int granted = 0;
+    socklen_t length = sizeof(granted);
+    if (getsockopt(fd, SOL_SOCKET, option, &granted, &length) != 0)
+    {
+        return std::error_code(errno, std::system_category());
+    }
+
+    return granted / 2 < bytes ? std::make_error_code(std::errc::no_buffer_space) : std::error_code();
+}
+
+/**
+ * True if any of the options is an affinity, which addThreadAffinity() can't take.
+ */
+template <class... Options>
+struct HasAffinityOption : std::false_type {};
+
+template <class Option, class... Rest>
+struct HasAffinityOption<Option, Rest...>
+    : std::integral_constant<bool, std::is_same<std::decay_t<Option>, Affinity>::value || HasAffinityOption<Rest...>::value> {};
+
+} // Namespace detail
+
+/**
+ * Adds a step creating a socket, closed on uninitialization.
+ * @param fd Receives the socket. Must outlive the sequence, as must all references passed to the
+ *           steps below.
+ */
+template <class... Options>
+StepHandle addSocket(SequentialRaii& seqraii, int& fd, int domain, int type, int protocol, const Options&... options)
+{
+    return seqraii.addStep(
+        [&fd, domain, type, protocol]()
+        {
+            fd = socket(domain, type | SOCK_CLOEXEC, protocol);
+            return detail::errnoUnless(fd >= 0);
+        },
+        [&fd]() noexcept
+        {
+            close(fd);
+            fd = -1;
+        },
+        options...);
+}
+
+/**
+ * Adds a step mapping anonymous memory, unmapped on uninitialization.
+ * @param flags Added to MAP_PRIVATE | MAP_ANONYMOUS. MAP_POPULATE faults all pages in up front, so
+ *              that the first access on the hot path doesn't. MAP_HUGETLB takes huge pages, which
+ *              must have been reserved, and a length that is a multiple of the huge page size.
+ */
+template <class... Options>
+StepHandle addMemoryMap(SequentialRaii& seqraii, void*& address, std::size_t length, int flags, const Options&... options)
+{
+    return seqraii.addStep(
+        [&address, length, flags]()
+        {
+            address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+            return detail::errnoUnless(address != MAP_FAILED);
+        },
+        [&address, length]() noexcept
+        {
+            munmap(address, length);
+            address = nullptr;
+        },
+        options...);
+}
+
+/**
+ * Adds a step locking memory into RAM, so that it is never paged out, unlocked on uninitialization.
+ * Typically follows addMemoryMap() with the same address. Fails with ENOMEM or EPERM beyond
+ * RLIMIT_MEMLOCK.
+ * @param address Start of the memory, read when the step initializes.
+ */
+template <class... Options>
+StepHandle addMemoryLock(SequentialRaii& seqraii, void* const& address, std::size_t length, const Options&... options)
+{
+    return seqraii.addStep(
+        [&address, length]()
+        {
+            return detail::errnoUnless(mlock(address, length) == 0);
+        },
+        [&address, length]() noexcept
+        {
+            munlock(address, length);
+        },
+        options...);
+}
+
+/**
+ * Adds a step sizing the receive and send buffers of a socket, failing with ENOBUFS if the kernel
+ * grants less than asked for. Processes with CAP_NET_ADMIN get the size beyond the sysctl limits.
+ * @param receiveBytes Receive buffer size, 0 to leave it alone. Likewise sendBytes.
+ */
+template <class... Options>
+StepHandle addSocketBuffers(SequentialRaii& seqraii, const int& fd, int receiveBytes, int sendBytes, const Options&... options)
+{
+    return seqraii.addStep(
+        [&fd, receiveBytes, sendBytes]()
+        {
+            std::error_code error;
+            if (receiveBytes > 0)
+            {
+                error = detail::setBufferSize(fd, SO_RCVBUF, SO_RCVBUFFORCE, receiveBytes);
+            }
+
+            if (!error && sendBytes > 0)
+            {
+                error = detail::setBufferSize(fd, SO_SNDBUF, SO_SNDBUFFORCE, sendBytes);
+            }
+
+            return error;
+        },
+        options...);
+}
+
+/**
+ * Adds a step making blocking receives on a socket busy poll the device queue for up to the given
+ * time before sleeping. Raising it above the net.core.busy_poll sysctl needs CAP_NET_ADMIN.
+ */
+template <class... Options>
+StepHandle addBusyPoll(SequentialRaii& seqraii, const int& fd, int microseconds, const Options&... options)
+{
+    return seqraii.addStep(
+        [&fd, microseconds]()
+        {
+            return detail::errnoUnless(setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &microseconds, sizeof(microseconds)) == 0);
+        },
+        options...);
+}
+
+/**
+ * Adds a step pinning the initializing thread to the given CPUs for good, unlike the affinity()
+ * option. Uninitialization gives that thread back the CPUs it had, from whichever thread it runs on.
+ * The step runs outside of SequentialRaii::setAffinity(), and takes no affinity() or numaNode()
+ * option, as restoring the thread's CPUs after the step would undo the pinning.
+ */
+template <class... Options>
+StepHandle addThreadAffinity(SequentialRaii& seqraii, const Affinity& affinity, const Options&... options)
+{
+    static_assert(!detail::HasAffinityOption<Options...>::value, "addThreadAffinity: the step pins the thread itself, pass no affinity option");
+
+    struct Pinning
+    {
+        pid_t thread = 0;
+        cpu_set_t previous;
+    };
+
+    // Shared by the two lambdas, and allocated here rather than when the step runs.
+    std::shared_ptr<Pinning> pinning = std::make_shared<Pinning>();
+    return seqraii.addStep(
+        [pinning, affinity]()
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (std::size_t cpu = 0; cpu < affinity.cpus.size() && cpu < CPU_SETSIZE; ++cpu)
+            {
+                if (affinity.cpus[cpu])
+                {
+                    CPU_SET(cpu, &cpus);
+                }
+            }
+
+            pinning->thread = static_cast<pid_t>(syscall(SYS_gettid));
+            return detail::errnoUnless(sched_getaffinity(pinning->thread, sizeof(pinning->previous), &pinning->previous) == 0 &&
+                                       sched_setaffinity(pinning->thread, sizeof(cpus), &cpus) == 0);
+        },
+        [pinning]() noexcept
+        {
+            // Fails harmlessly with ESRCH once the thread is gone.
+            sched_setaffinity(pinning->thread, sizeof(pinning->previous), &pinning->previous);
+        },
+        Affinity(), options...);
+}
+
+/**
+ * Adds a step creating an eventfd with a count of zero, closed on uninitialization.
+ * @param flags EFD_NONBLOCK and EFD_SEMAPHORE, or 0.
+ */
+template <class... Options>
+StepHandle addEventFd(SequentialRaii& seqraii, int& fd, int flags, const Options&... options)
+{
+    return seqraii.addStep(
+        [&fd, flags]()
+        {
+            fd = eventfd(0, flags | EFD_CLOEXEC);
+            return detail::errnoUnless(fd >= 0);
+        },
+        [&fd]() noexcept
+        {
+            close(fd);
+            fd = -1;
+        },
+        options...);
+}
+
+/**
+ * Adds a step creating an epoll instance, closed on uninitialization.
+ */
+template <class... Options>
+StepHandle addEpoll(SequentialRaii& seqraii, int& fd, const Options&... options)
+{
+    return seqraii.addStep(
+        [&fd]()
+        {
+            fd = epoll_create1(EPOLL_CLOEXEC);
+            return detail::errnoUnless(fd >= 0);
+        },
+        [&fd]() noexcept
+        {
+            close(fd);
+            fd = -1;
+        },
+        options...);
+}
+
+/**
+ * Adds a step registering a file descriptor with an epoll instance for the given events, which are
+ * reported with the file descriptor as their data. Deregistered on uninitialization.
+ */
+template <class... Options>
+StepHandle addEpollWatch(SequentialRaii& seqraii, const int& epollFd, const int& fd, std::uint32_t events,
+                         const Options&... options)
+{
+    return seqraii.addStep(
+        [&epollFd, &fd, events]()
+        {
+            epoll_event event = {};
+            event.events = events;
+            event.data.fd = fd;
+            return detail::errnoUnless(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0);
+        },
+        [&epollFd, &fd]() noexcept
+        {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        },
+        options...);
+}
+
+} // Namespace sequentialraii
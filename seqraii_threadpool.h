@@ -0,0 +1,184 @@
+/**
+ * Work-stealing thread pool for running SequentialRaii steps in parallel.
+ *
+ * License: MIT license. See separate file for full disclaimer.
+ * Compile with C++14 enabled.
+ */
+#pragma once
+
+#include "seqraii.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sequentialraii
+{
+/**
+ * Fixed size thread pool. Every worker has its own task queue: tasks submitted from a worker go to
+ * the back of its own queue and are taken from there first, while idle workers steal from the front
+ * of the other queues. Tasks submitted from outside are spread over the queues round-robin.
+ * Tasks must not throw.
+ */
+class ThreadPool final : public Executor
+{
+public:
+    /**
+     * Starts the worker threads.
+     * @param threads Number of workers, at least one.
+     */
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency())
+    {
+        threads = threads > 0 ? threads : 1;
+        for (std::size_t i = 0; i < threads; ++i)
+        {
+            m_queues.emplace_back(std::make_unique<Queue>());
+        }
+
+        for (std::size_t i = 0; i < threads; ++i)
+        {
+            m_threads.emplace_back([this, i]() {run(i);});
+        }
+    }
+
+    /**
+     * Runs any queued tasks to completion and joins the workers.
+     */
+    ~ThreadPool() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+
+        m_wakeup.notify_all();
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t size() const noexcept
+    {
+        return m_threads.size();
+    }
+
+    virtual void execute(std::function<void()> task) override
+    {
+        // Workers keep their own tasks local, everyone else spreads them out.
+        const std::size_t index = (currentPool() == this)
+            ? currentWorker()
+            : m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+
+        {
+            std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(task));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_pending;
+        }
+
+        m_wakeup.notify_one();
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    static ThreadPool*& currentPool() noexcept
+    {
+        static thread_local ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    static std::size_t& currentWorker() noexcept
+    {
+        static thread_local std::size_t worker = 0;
+        return worker;
+    }
+
+    void run(std::size_t index)
+    {
+        currentPool() = this;
+        currentWorker() = index;
+
+        while (true)
+        {
+            // Every decrement of the pending count claims one queued task.
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wakeup.wait(lock, [this]() {return m_pending > 0 || m_stopping;});
+                if (m_pending == 0)
+                {
+                    return;
+                }
+
+                --m_pending;
+            }
+
+            std::function<void()> task;
+            while (!take(index, task))
+            {
+                std::this_thread::yield();
+            }
+
+            task();
+        }
+    }
+
+    /**
+     * Takes the newest task of the worker's own queue, or steals the oldest task of another one.
+     */
+    bool take(std::size_t index, std::function<void()>& task)
+    {
+        {
+            Queue& own = *m_queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (std::size_t i = 1; i < m_queues.size(); ++i)
+        {
+            Queue& other = *m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.tasks.empty())
+            {
+                task = std::move(other.tasks.front());
+                other.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<std::size_t> m_next{0};
+
+    /// Number of queued tasks not yet claimed by a worker.
+    std::size_t m_pending = 0;
+    bool m_stopping = false;
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+};
+
+} // Namespace sequentialraii
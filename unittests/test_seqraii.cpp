@@ -1,7 +1,40 @@
 #include "../seqraii.h"
+#include "../seqraii_blueprint.h"
+#include "../seqraii_hotswap.h"
+#include "../seqraii_pool.h"
+#include "../seqraii_reaper.h"
+#include "../seqraii_report.h"
+#include "../seqraii_shared.h"
+#include "../seqraii_threadpool.h"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
+#if SEQRAII_HAS_MEMORY_RESOURCE
+#include <memory_resource>
+#endif
+
+#if defined(__linux__)
+#include "../seqraii_steps.h"
+#include <netinet/in.h>
+#endif
+
+#if defined(__cpp_impl_coroutine)
+#include "../seqraii_async.h"
+#include <deque>
+#endif
+
 using namespace sequentialraii;
 
 /**
@@ -195,6 +228,1626 @@ TEST(seqraii, test_move_operation)
     EXPECT_TRUE(didCleanup);
 }
 
+/**
+ * Test order of initialization and uninitialization for a compile-time sequence.
+ */
+TEST(seqraii, test_static_sequence_order)
+{
+    std::vector<int> counter;
+
+    {
+        auto seqraii = makeSequence(
+            step([&]() {counter.push_back(0); return true;}, [&]() {counter.push_back(3);}),
+            step([&]() {counter.push_back(1); return true;}, [&]() {counter.push_back(2);}));
+
+        EXPECT_TRUE(seqraii.initialize());
+        EXPECT_EQ(2, counter.size());
+    }
+
+    // Verify values, leaving scope runs uninitialization in reverse order.
+    ASSERT_EQ(4, counter.size());
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_EQ(i, counter[i]);
+    }
+}
+
+/**
+ * Test failed initialization of a compile-time sequence. Steps after the failing one must not
+ * run, and only the steps that succeeded must be rolled back.
+ */
+TEST(seqraii, test_static_sequence_failed_initialization)
+{
+    std::vector<int> counter;
+    int cleanups = 0;
+
+    auto seqraii = makeSequence(
+        step([&]() {counter.push_back(0); return true;}, [&]() {++cleanups;}),
+        step([&]() {counter.push_back(1); throw std::runtime_error(""); return true;}, [&]() {++cleanups;}),
+        step([&]() {counter.push_back(2); return true;}));
+
+    EXPECT_FALSE(seqraii.initialize());
+    EXPECT_EQ(2, counter.size());
+    EXPECT_EQ(1, cleanups);
+
+    // Nothing left to clean up.
+    seqraii.uninitialize();
+    EXPECT_EQ(1, cleanups);
+}
+
+/**
+ * Test that uninitialization only touches steps that were initialized, and that initialization
+ * resumes after the last initialized step.
+ */
+TEST(seqraii, test_initialization_high_water_mark)
+{
+    std::vector<int> counter;
+    int uninitialized = 0;
+
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {counter.push_back(0); return true;}, [&]() {++uninitialized;});
+    seqraii.addStep([&]() {counter.push_back(1); return true;}, [&]() {++uninitialized;});
+    seqraii.addStep([&]() {counter.push_back(2); return true;}, [&]() {++uninitialized;});
+
+    EXPECT_TRUE(seqraii.initialize());
+    EXPECT_EQ(3, seqraii.initializedSteps());
+
+    // Steps added later are initialized on the next call, the others are left as they are.
+    seqraii.addStep([&]() {counter.push_back(3); return true;}, [&]() {++uninitialized;});
+    seqraii.addStep([&]() {return false;}, [&]() {++uninitialized;});
+    EXPECT_EQ(3, seqraii.initializedSteps());
+
+    EXPECT_FALSE(seqraii.initialize());
+    EXPECT_EQ(0, seqraii.initializedSteps());
+    EXPECT_EQ((std::vector<int>{0, 1, 2, 3}), counter);
+
+    // The failing step never ran, so it is not uninitialized.
+    EXPECT_EQ(4, uninitialized);
+    seqraii.uninitialize();
+    EXPECT_EQ(4, uninitialized);
+}
+
+/**
+ * Test partial rollback and re-initialization of the tail of a checkpoint. Steps before the
+ * checkpoint must be left alone, also when the tail fails.
+ */
+TEST(seqraii, test_checkpoint)
+{
+    int socketInits = 0;
+    int optionInits = 0;
+    int optionUninits = 0;
+    bool optionFails = false;
+
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {++socketInits; return true;});
+    const Checkpoint options = seqraii.checkpoint();
+    seqraii.addStep([&]() {++optionInits; return !optionFails;}, [&]() {++optionUninits;});
+    seqraii.addStep([&]() {return true;});
+
+    ASSERT_TRUE(seqraii.initialize());
+
+    seqraii.rollbackTo(options);
+    EXPECT_EQ(1, seqraii.initializedSteps());
+    EXPECT_EQ(1, optionUninits);
+
+    // Re-initializing redoes the tail only, rolling it back first if needed.
+    EXPECT_TRUE(seqraii.initializeFrom(options));
+    EXPECT_TRUE(seqraii.initializeFrom(options));
+    EXPECT_EQ(1, socketInits);
+    EXPECT_EQ(3, optionInits);
+    EXPECT_EQ(2, optionUninits);
+
+    optionFails = true;
+    EXPECT_FALSE(seqraii.initializeFrom(options));
+    EXPECT_EQ(1, seqraii.initializedSteps());
+    EXPECT_EQ(1, socketInits);
+}
+
+/**
+ * Test re-initializing from a checkpoint whose prefix isn't initialized. No step may run, as a
+ * failure would leave part of the prefix initialized.
+ */
+TEST(seqraii, test_checkpoint_uninitialized_prefix)
+{
+    int inits = 0;
+
+    SequentialRaii seqraii;
+    const Checkpoint start = seqraii.checkpoint();
+    seqraii.addStep([&]() {++inits; return true;});
+    const Checkpoint tail = seqraii.checkpoint();
+    seqraii.addStep([&]() {++inits; return true;});
+
+    EXPECT_FALSE(seqraii.initializeFrom(tail));
+    EXPECT_EQ(0, inits);
+    EXPECT_EQ(0, seqraii.initializedSteps());
+
+    ASSERT_TRUE(seqraii.initialize());
+    seqraii.rollbackTo(start);
+    EXPECT_FALSE(seqraii.initializeFrom(tail));
+    EXPECT_EQ(2, inits);
+
+    // The empty prefix of the first checkpoint is always initialized.
+    EXPECT_TRUE(seqraii.initializeFrom(start));
+    EXPECT_EQ(4, inits);
+}
+
+/**
+ * Test retrying a failing step in place. Steps before it must not be initialized again.
+ */
+TEST(seqraii, test_retry_policy)
+{
+    int first = 0;
+    int attempts = 0;
+
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {++first; return true;});
+    seqraii.addStep([&]() {return ++attempts >= 3;}, retry(3, std::chrono::milliseconds(1)));
+
+    EXPECT_TRUE(seqraii.initialize());
+    EXPECT_EQ(1, first);
+    EXPECT_EQ(3, attempts);
+
+    // Out of attempts, now the sequence is rolled back.
+    seqraii.uninitialize();
+    attempts = -10;
+    EXPECT_FALSE(seqraii.initialize());
+    EXPECT_EQ(-7, attempts);
+    EXPECT_EQ(0, seqraii.initializedSteps());
+}
+
+/**
+ * Test that retrying stops when running out of time.
+ */
+TEST(seqraii, test_retry_policy_deadline)
+{
+    int attempts = 0;
+
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {++attempts; return false;}, retry(1000, std::chrono::milliseconds(5), std::chrono::milliseconds(30)));
+
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(seqraii.initialize());
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+    EXPECT_GT(attempts, 1);
+    EXPECT_LT(attempts, 1000);
+}
+
+/**
+ * Test that a failed initialization reports the failing step together with errno.
+ */
+TEST(seqraii, test_init_result_errno)
+{
+    SequentialRaii seqraii;
+    seqraii.addStep([]() {return true;}, []() {});
+    seqraii.addStep([]() {errno = EACCES; return false;}, []() {}, label("open"));
+
+    InitResult result;
+    EXPECT_FALSE(seqraii.initialize(result));
+    EXPECT_FALSE(result);
+    EXPECT_EQ(result.failedStep, 1u);
+    EXPECT_STREQ(result.label, "open");
+    EXPECT_EQ(result.error, std::error_code(EACCES, std::system_category()));
+    EXPECT_FALSE(result.exception);
+
+    seqraii = SequentialRaii();
+    seqraii.addStep([]() {return std::error_code();}, []() {});
+    EXPECT_TRUE(seqraii.initialize(result));
+    EXPECT_TRUE(result);
+}
+
+/**
+ * Test that error codes returned and exceptions thrown by steps are reported.
+ */
+TEST(seqraii, test_init_result_exception)
+{
+    SequentialRaii seqraii;
+    seqraii.addStep([]() {return std::make_error_code(std::errc::address_in_use);}, []() {});
+
+    InitResult result;
+    EXPECT_FALSE(seqraii.initialize(result));
+    EXPECT_EQ(result.failedStep, 0u);
+    EXPECT_EQ(result.error, std::errc::address_in_use);
+
+    SequentialRaii throwing;
+    throwing.addStep([]() -> bool {throw std::runtime_error("boom");}, []() {});
+    EXPECT_FALSE(throwing.initialize(result));
+    EXPECT_EQ(result.failedStep, 0u);
+    ASSERT_TRUE(result.exception);
+    EXPECT_THROW(std::rethrow_exception(result.exception), std::runtime_error);
+}
+
+/**
+ * Test that lazy steps initialize once on first use and are uninitialized in order if they ran.
+ */
+TEST(seqraii, test_lazy_step)
+{
+    std::atomic<int> runs{0};
+    std::vector<int> order;
+
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {order.push_back(1); return true;}, [&]() {order.push_back(-1);});
+    auto lazy = seqraii.addLazyStep([&]() {++runs; order.push_back(2); return true;}, [&]() {order.push_back(-2);});
+    auto unused = seqraii.addLazyStep([&]() {order.push_back(3); return true;}, [&]() {order.push_back(-3);});
+    seqraii.addStep([&]() {order.push_back(4); return true;}, [&]() {order.push_back(-4);}, after(lazy));
+
+    EXPECT_FALSE(lazy.acquire());
+    EXPECT_TRUE(seqraii.initialize());
+    EXPECT_EQ(runs.load(), 0);
+
+    // Moving the sequence keeps the handles valid.
+    SequentialRaii moved(std::move(seqraii));
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&]() {EXPECT_TRUE(lazy.acquire());});
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(runs.load(), 1);
+    moved.uninitialize();
+    EXPECT_EQ(order, std::vector<int>({1, 4, 2, -4, -2, -1}));
+    EXPECT_FALSE(unused.acquire());
+}
+
+/**
+ * Test that threads racing to initialize a shared sequence run its steps exactly once.
+ */
+TEST(seqraii, test_shared_initialization)
+{
+    std::atomic<int> runs{0};
+    std::atomic<int> cleanups{0};
+    std::atomic<int> attempts{0};
+
+    SequentialRaii sequence;
+    sequence.addStep([&]() {return ++attempts > 1;});
+    sequence.addStep([&]() {++runs; std::this_thread::sleep_for(std::chrono::milliseconds(20)); return true;}, [&]() {++cleanups;});
+    SharedSequentialRaii shared(std::move(sequence));
+
+    // The first attempt fails, the next caller tries again.
+    InitResult result;
+    EXPECT_FALSE(shared.initialize(result));
+    EXPECT_EQ(result.failedStep, 0u);
+
+    std::atomic<int> successes{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&]() {successes += shared.initialize() ? 1 : 0;});
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(successes.load(), 4);
+    EXPECT_EQ(runs.load(), 1);
+    EXPECT_TRUE(shared.initialized());
+
+    shared.uninitialize();
+    EXPECT_FALSE(shared.initialized());
+    EXPECT_EQ(cleanups.load(), 1);
+}
+
+/**
+ * Test that a pool hands out warm resources, recycles them and rebuilds the ones failing reset.
+ */
+TEST(seqraii, test_pool)
+{
+    std::atomic<int> builds{0};
+    std::atomic<int> teardowns{0};
+    {
+        SequentialRaiiPool<int> pool(2,
+            [&](SequentialRaii& sequence, int& value)
+            {
+                sequence.addStep([&]() {value = ++builds; return true;}, [&]() {++teardowns;});
+            },
+            [](int& value) {return value > 0;});
+
+        EXPECT_EQ(builds.load(), 2);
+        EXPECT_EQ(pool.available(), 2u);
+
+        auto first = pool.acquire();
+        auto second = pool.acquire();
+        ASSERT_TRUE(first);
+        ASSERT_TRUE(second);
+        EXPECT_FALSE(pool.acquire());
+
+        // A successful reset recycles the resource as it is.
+        first.release();
+        EXPECT_EQ(pool.available(), 1u);
+        EXPECT_EQ(builds.load(), 2);
+
+        // A failed one has the background thread rebuild it.
+        *second = 0;
+        second.release();
+        for (int i = 0; i < 200 && pool.available() < 2; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+
+        EXPECT_EQ(pool.available(), 2u);
+        EXPECT_EQ(builds.load(), 3);
+        EXPECT_EQ(teardowns.load(), 1);
+    }
+
+    EXPECT_EQ(teardowns.load(), 3);
+}
+
+/**
+ * Test that the pool grows in the background when running low.
+ */
+TEST(seqraii, test_pool_growth)
+{
+    SequentialRaiiPool<int> pool(1, [](SequentialRaii& sequence, int& value) {sequence.addStep([&]() {value = 1; return true;});}, {}, 3, 1);
+
+    std::vector<SequentialRaiiPool<int>::Lease> leases;
+    for (std::size_t size = 2; size <= 3; ++size)
+    {
+        leases.push_back(pool.acquire());
+        ASSERT_TRUE(leases.back());
+        EXPECT_EQ(*leases.back(), 1);
+        for (int i = 0; i < 200 && pool.available() == 0; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+
+        EXPECT_EQ(pool.size(), size);
+    }
+
+    // The pool doesn't grow beyond its maximum size.
+    leases.push_back(pool.acquire());
+    ASSERT_TRUE(leases.back());
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(pool.size(), 3u);
+    EXPECT_FALSE(pool.acquire());
+}
+
+/**
+ * Test that instances of a blueprint run the shared steps on their own contexts.
+ */
+TEST(seqraii, test_blueprint)
+{
+    struct Context
+    {
+        explicit Context(int id_)
+            : id(id_)
+        {}
+
+        int id;
+        std::vector<int> steps;
+    };
+
+    std::vector<int> cleanups;
+    auto instances = [&]()
+    {
+        SequenceBlueprint<Context> blueprint;
+        blueprint.addStep([](Context& c) {c.steps.push_back(1); return true;}, [&](Context& c) {cleanups.push_back(c.id);}, label("first"));
+        blueprint.addStep([](Context& c) {c.steps.push_back(2); return c.id != 2;}, label("second"));
+        EXPECT_EQ(blueprint.size(), 2u);
+
+        std::vector<std::unique_ptr<BlueprintInstance<Context>>> result;
+        for (int id = 0; id < 3; ++id)
+        {
+            result.push_back(blueprint.instantiate(id));
+        }
+
+        return result;
+    }();
+
+    // The blueprint is gone, its steps live on in the instances.
+    EXPECT_TRUE(instances[0]->sequence().initialize());
+    EXPECT_TRUE(instances[1]->sequence().initialize());
+
+    InitResult result;
+    EXPECT_FALSE(instances[2]->sequence().initialize(result));
+    EXPECT_STREQ(result.label, "second");
+    EXPECT_EQ(cleanups, std::vector<int>({2}));
+
+    EXPECT_EQ(instances[0]->context().steps, std::vector<int>({1, 2}));
+    EXPECT_EQ(instances[2]->context().steps, std::vector<int>({1, 2}));
+
+    instances.clear();
+    EXPECT_EQ(cleanups, std::vector<int>({2, 0, 1}));
+}
+
+/**
+ * Test that blueprint steps pass affinity options on to their instances.
+ */
+TEST(seqraii, test_blueprint_options)
+{
+    struct Context
+    {
+        int boundCpus = 0;
+    };
+
+    SequenceBlueprint<Context> blueprint;
+#if SEQRAII_HAS_AFFINITY
+    cpu_set_t allowed;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    unsigned cpu = 0;
+    while (!CPU_ISSET(cpu, &allowed))
+    {
+        ++cpu;
+    }
+
+    blueprint.addStep(
+        [](Context& c)
+        {
+            cpu_set_t cpus;
+            sched_getaffinity(0, sizeof(cpus), &cpus);
+            c.boundCpus = CPU_COUNT(&cpus);
+            return true;
+        },
+        affinity({cpu}));
+#endif
+    blueprint.addStep([](Context&) {return true;}, numaNode(0));
+
+    auto instance = blueprint.instantiate();
+    EXPECT_TRUE(instance->sequence().initialize());
+#if SEQRAII_HAS_AFFINITY
+    EXPECT_EQ(instance->context().boundCpus, 1);
+#endif
+}
+
+/**
+ * Test health checks of blueprint steps. Each instance must check its own context, and heal only
+ * itself.
+ */
+TEST(seqraii, test_blueprint_verify)
+{
+    struct Context
+    {
+        int connects = 0;
+        bool connected = false;
+    };
+
+    SequenceBlueprint<Context> blueprint;
+    blueprint.addStep([](Context&) {return true;});
+    blueprint.addStep([](Context& c) {++c.connects; c.connected = true; return true;},
+                      [](Context& c) {c.connected = false;},
+                      verify([](Context& c) {return c.connected;}));
+
+    auto first = blueprint.instantiate();
+    auto second = blueprint.instantiate();
+    ASSERT_TRUE(first->sequence().initialize());
+    ASSERT_TRUE(second->sequence().initialize());
+    EXPECT_EQ(first->sequence().checkHealth(), static_cast<std::size_t>(InitResult::kNoStep));
+
+    first->context().connected = false;
+    EXPECT_EQ(first->sequence().checkHealth(), 1u);
+    EXPECT_EQ(second->sequence().checkHealth(), static_cast<std::size_t>(InitResult::kNoStep));
+
+    EXPECT_TRUE(first->sequence().heal());
+    EXPECT_EQ(first->context().connects, 2);
+    EXPECT_EQ(second->context().connects, 1);
+    EXPECT_EQ(first->sequence().checkHealth(), static_cast<std::size_t>(InitResult::kNoStep));
+}
+
+/**
+ * Test that noexcept lambdas are told apart from those that may throw, which still have their
+ * exceptions caught during initialization and uninitialization.
+ */
+TEST(seqraii, test_noexcept_steps)
+{
+    auto nothrowInit = []() noexcept {return true;};
+    auto throwingInit = []() {return true;};
+    auto nothrowUninit = []() noexcept {};
+    static_assert(detail::IsNothrowInit<decltype(nothrowInit)>::value, "noexcept init not detected");
+    static_assert(!detail::IsNothrowInit<decltype(throwingInit)>::value, "throwing init taken for noexcept");
+    static_assert(detail::IsNothrowUninit<decltype(nothrowUninit)>::value, "noexcept uninit not detected");
+
+    std::vector<int> order;
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() noexcept {order.push_back(1); return true;}, [&]() noexcept {order.push_back(-1);});
+    seqraii.addStep([&]() {order.push_back(2); return true;}, [&]() {order.push_back(-2); throw std::runtime_error("boom");});
+    seqraii.addStep([]() -> bool {throw std::runtime_error("boom");});
+
+    InitResult result;
+    EXPECT_FALSE(seqraii.initialize(result));
+    EXPECT_EQ(result.failedStep, 2u);
+    EXPECT_TRUE(result.exception);
+    EXPECT_EQ(order, (std::vector<int>{1, 2, -2, -1}));
+}
+
+/**
+ * Test that a step finishing after the deadline is rolled back with the steps before it, and that
+ * the result names it.
+ */
+TEST(seqraii, test_initialize_deadline)
+{
+    std::vector<int> order;
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {order.push_back(1); return true;}, [&]() {order.push_back(-1);});
+    seqraii.addStep(
+        [&]()
+        {
+            order.push_back(2);
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            return true;
+        },
+        [&]() {order.push_back(-2);},
+        label("slow"));
+    seqraii.addStep([&]() {order.push_back(3); return true;}, [&]() {order.push_back(-3);});
+
+    InitResult result;
+    EXPECT_FALSE(seqraii.initialize(std::chrono::steady_clock::now() + std::chrono::milliseconds(10), result));
+    EXPECT_EQ(result.failedStep, 1u);
+    EXPECT_STREQ(result.label, "slow");
+    EXPECT_EQ(result.error, std::errc::timed_out);
+    EXPECT_EQ(order, (std::vector<int>{1, 2, -2, -1}));
+    EXPECT_EQ(seqraii.initializedSteps(), 0u);
+
+    // A deadline already passed runs nothing.
+    order.clear();
+    EXPECT_FALSE(seqraii.initialize(std::chrono::steady_clock::now(), result));
+    EXPECT_EQ(result.failedStep, 0u);
+    EXPECT_TRUE(order.empty());
+
+    EXPECT_TRUE(seqraii.initialize(std::chrono::steady_clock::now() + std::chrono::seconds(10)));
+    EXPECT_EQ(seqraii.initializedSteps(), 3u);
+}
+
+/**
+ * Test that steps taking a stop token see a stop requested from another thread, and that a
+ * cancelled initialization is rolled back.
+ */
+TEST(seqraii, test_initialize_cancellation)
+{
+    std::vector<int> order;
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {order.push_back(1); return true;}, [&]() {order.push_back(-1);});
+    seqraii.addStep(
+        [&](const StopToken& stop)
+        {
+            order.push_back(2);
+            while (!stop.stopRequested())
+            {
+                std::this_thread::yield();
+            }
+
+            return false;
+        },
+        [&]() {order.push_back(-2);});
+
+    StopSource source;
+    std::thread canceller(
+        [&]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            source.requestStop();
+        });
+
+    InitResult result;
+    EXPECT_FALSE(seqraii.initialize(source.token(), result));
+    canceller.join();
+    EXPECT_EQ(result.failedStep, 1u);
+    EXPECT_EQ(result.error, std::errc::operation_canceled);
+    EXPECT_EQ(order, (std::vector<int>{1, 2, -1}));
+
+    // Without a source the step gets a token that never stops.
+    SequentialRaii unstoppable;
+    bool sawStop = true;
+    unstoppable.addStep([&](const StopToken& stop) {sawStop = stop.stopRequested(); return true;});
+    EXPECT_TRUE(unstoppable.initialize());
+    EXPECT_FALSE(sawStop);
+}
+
+/**
+ * Test that retired sequences are uninitialized in reverse order on the reaper's thread, both when
+ * retired explicitly and when destroyed with a reaper set.
+ */
+TEST(seqraii, test_retire_async)
+{
+    std::mutex mutex;
+    std::vector<int> order;
+    std::vector<std::thread::id> threads;
+    auto record = [&](int value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(value);
+        threads.push_back(std::this_thread::get_id());
+    };
+
+    BackgroundReaper reaper;
+    SequentialRaii seqraii;
+    seqraii.addStep([]() {return true;}, [&]() {record(-1);});
+    seqraii.addStep([]() {return true;}, [&]() {record(-2);});
+    EXPECT_TRUE(seqraii.initialize());
+
+    seqraii.retireAsync(reaper);
+    EXPECT_EQ(seqraii.initializedSteps(), 0u);
+    {
+        SequentialRaii scoped;
+        scoped.setReaper(&reaper);
+        scoped.addStep([]() {return true;}, [&]() {record(-3);});
+        EXPECT_TRUE(scoped.initialize());
+    }
+
+    reaper.drain();
+    EXPECT_EQ(order, (std::vector<int>{-2, -1, -3}));
+    for (const auto& thread : threads)
+    {
+        EXPECT_NE(thread, std::this_thread::get_id());
+    }
+}
+
+/**
+ * Test that a full backlog makes retiring uninitialize on the calling thread with the inline
+ * overflow policy.
+ */
+TEST(seqraii, test_retire_backpressure)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool release = false;
+    std::atomic<int> done{0};
+    std::thread::id inlineThread;
+
+    BackgroundReaper reaper(1, BackgroundReaper::Overflow::kInline);
+    auto makeSequence = [&](bool block)
+    {
+        SequentialRaii sequence;
+        sequence.addStep([]() {return true;},
+            [&, block]()
+            {
+                if (block)
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() {return release;});
+                }
+                else
+                {
+                    inlineThread = std::this_thread::get_id();
+                }
+
+                ++done;
+            });
+        sequence.initialize();
+        return sequence;
+    };
+
+    // The first one keeps the reaper busy, the second fills the backlog.
+    SequentialRaii busy = makeSequence(true);
+    busy.retireAsync(reaper);
+    while (reaper.backlog() > 0)
+    {
+        std::this_thread::yield();
+    }
+
+    SequentialRaii queued = makeSequence(true);
+    queued.retireAsync(reaper);
+    EXPECT_EQ(reaper.backlog(), 1u);
+
+    SequentialRaii overflow = makeSequence(false);
+    overflow.retireAsync(reaper);
+    EXPECT_EQ(done.load(), 1);
+    EXPECT_EQ(inlineThread, std::this_thread::get_id());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+
+    cv.notify_all();
+    reaper.drain();
+    EXPECT_EQ(done.load(), 3);
+}
+
+/**
+ * Test that a hot swap brings up the replacement before tearing down the live generation, waits
+ * for its readers, and keeps it when the replacement fails.
+ */
+TEST(seqraii, test_hot_swap)
+{
+    std::mutex mutex;
+    std::vector<std::string> events;
+    auto record = [&](const std::string& event)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back(event);
+    };
+
+    HotSwap<int> swap;
+    EXPECT_FALSE(swap.read());
+
+    auto build = [&](int id, bool fail)
+    {
+        return [&, id, fail](SequentialRaii& sequence, int& value)
+        {
+            sequence.addStep([&, id, fail]() {value = id; record("up " + std::to_string(id)); return !fail;},
+                             [&, id]() {record("down " + std::to_string(id));});
+        };
+    };
+
+    EXPECT_TRUE(swap.replace(build(1, false)));
+    HotSwap<int>::Reader reader = swap.read();
+    ASSERT_TRUE(reader);
+    EXPECT_EQ(*reader, 1);
+
+    // The old generation stays up for as long as the reader uses it.
+    std::thread replacer([&]() {EXPECT_TRUE(swap.replace(build(2, false)));});
+    while (swap.generation() < 2)
+    {
+        std::this_thread::yield();
+    }
+
+    EXPECT_EQ(*swap.read(), 2);
+    EXPECT_EQ(*reader, 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        EXPECT_EQ(events, (std::vector<std::string>{"up 1", "up 2"}));
+    }
+
+    reader.release();
+    replacer.join();
+    EXPECT_EQ(events, (std::vector<std::string>{"up 1", "up 2", "down 1"}));
+
+    // A replacement failing to come up leaves the live generation alone.
+    InitResult result;
+    EXPECT_FALSE(swap.replace(build(3, true), &result));
+    EXPECT_EQ(result.failedStep, 0u);
+    EXPECT_EQ(*swap.read(), 2);
+    EXPECT_EQ(swap.generation(), 2u);
+    EXPECT_EQ(events, (std::vector<std::string>{"up 1", "up 2", "down 1", "up 3"}));
+}
+
+/**
+ * Test that readers never see a torn down generation while generations are replaced under them
+ * and retired on a reaper.
+ */
+TEST(seqraii, test_hot_swap_readers)
+{
+    struct Resource
+    {
+        std::atomic<bool> up{false};
+    };
+
+    BackgroundReaper reaper;
+    HotSwap<Resource> swap(&reaper);
+    auto build = [](SequentialRaii& sequence, Resource& resource)
+    {
+        sequence.addStep([&]() {resource.up = true; return true;}, [&]() {resource.up = false;});
+    };
+
+    ASSERT_TRUE(swap.replace(build));
+    std::atomic<bool> stop{false};
+    std::atomic<int> torn{0};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]()
+        {
+            while (!stop)
+            {
+                HotSwap<Resource>::Reader reader = swap.read();
+                if (!reader || !reader->up)
+                {
+                    ++torn;
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_TRUE(swap.replace(build));
+    }
+
+    stop = true;
+    for (std::thread& reader : readers)
+    {
+        reader.join();
+    }
+
+    reaper.drain();
+    EXPECT_EQ(torn.load(), 0);
+    EXPECT_EQ(swap.generation(), 101u);
+}
+
+#if SEQRAII_HAS_AFFINITY
+/**
+ * Test that steps are initialized bound to their own or the sequence's affinity, that the thread
+ * gets its CPUs back afterwards, and that a CPU it can't be bound to fails the step.
+ */
+TEST(seqraii, test_step_affinity)
+{
+    cpu_set_t allowed;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    unsigned cpu = 0;
+    while (!CPU_ISSET(cpu, &allowed))
+    {
+        ++cpu;
+    }
+
+    auto boundCpus = []()
+    {
+        cpu_set_t cpus;
+        sched_getaffinity(0, sizeof(cpus), &cpus);
+        return CPU_COUNT(&cpus);
+    };
+
+    std::vector<int> counts;
+    SequentialRaii seqraii;
+    seqraii.setAffinity(affinity({cpu}));
+    seqraii.addStep([&]() {counts.push_back(boundCpus()); return true;});
+    seqraii.addStep([&]() {counts.push_back(boundCpus()); return true;}, affinity({cpu, cpu}));
+    seqraii.setAffinity(Affinity());
+    seqraii.addStep([&]() {counts.push_back(boundCpus()); return true;});
+    EXPECT_TRUE(seqraii.initialize());
+    EXPECT_EQ(counts, (std::vector<int>{CPU_COUNT(&allowed), 1, CPU_COUNT(&allowed)}));
+    EXPECT_EQ(boundCpus(), CPU_COUNT(&allowed));
+    seqraii.uninitialize();
+
+    // Applies to the sequence's affinity at the time of initializing.
+    counts.clear();
+    seqraii.setAffinity(affinity({cpu}));
+    EXPECT_TRUE(seqraii.initialize());
+    EXPECT_EQ(counts, (std::vector<int>{1, 1, 1}));
+    EXPECT_EQ(boundCpus(), CPU_COUNT(&allowed));
+
+    SequentialRaii unavailable;
+    unavailable.addStep([]() {return true;}, affinity({1023}), label("pinned"));
+    InitResult result;
+    EXPECT_FALSE(unavailable.initialize(result));
+    EXPECT_EQ(result.failedStep, 0u);
+    EXPECT_STREQ(result.label, "pinned");
+    EXPECT_EQ(result.error, std::error_code(EINVAL, std::system_category()));
+}
+#endif
+
+/**
+ * Test that a range of steps is a single entry initializing its items in order, and that a failing
+ * item rolls back exactly the items before it, in reverse order.
+ */
+TEST(seqraii, test_range_steps)
+{
+    std::vector<int> counter;
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {counter.push_back(-1); return true;}, [&]() {counter.push_back(-1);});
+    seqraii.addSteps(4, [&](std::size_t i) {counter.push_back(static_cast<int>(i)); return true;},
+                     [&](std::size_t i) {counter.push_back(10 + static_cast<int>(i));});
+    EXPECT_EQ(seqraii.size(), 2u);
+
+    EXPECT_TRUE(seqraii.initialize());
+    EXPECT_EQ(counter, (std::vector<int>{-1, 0, 1, 2, 3}));
+    counter.clear();
+    seqraii.uninitialize();
+    EXPECT_EQ(counter, (std::vector<int>{13, 12, 11, 10, -1}));
+
+    counter.clear();
+    SequentialRaii failing;
+    failing.addSteps(5,
+        [&](std::size_t i)
+        {
+            counter.push_back(static_cast<int>(i));
+            errno = EMFILE;
+            return i != 3;
+        },
+        [&](std::size_t i) {counter.push_back(10 + static_cast<int>(i));},
+        label("fds"));
+
+    InitResult result;
+    EXPECT_FALSE(failing.initialize(result));
+    EXPECT_EQ(counter, (std::vector<int>{0, 1, 2, 3, 12, 11, 10}));
+    EXPECT_EQ(result.failedStep, 0u);
+    EXPECT_EQ(result.failedItem, 3u);
+    EXPECT_STREQ(result.label, "fds");
+    EXPECT_EQ(result.error, std::error_code(EMFILE, std::system_category()));
+}
+
+#if defined(__linux__)
+/**
+ * Test the prebuilt steps against the kernel: resources they create are usable while the sequence
+ * is initialized and released afterwards, and failures carry errno.
+ */
+TEST(seqraii, test_prebuilt_steps)
+{
+    int socketfd = -1;
+    void* memory = nullptr;
+    int wakefd = -1;
+    int epollfd = -1;
+    cpu_set_t allowed;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    unsigned cpu = 0;
+    while (!CPU_ISSET(cpu, &allowed))
+    {
+        ++cpu;
+    }
+
+    SequentialRaii seqraii;
+    addSocket(seqraii, socketfd, AF_INET, SOCK_DGRAM, 0);
+    addSocketBuffers(seqraii, socketfd, 64 * 1024, 32 * 1024);
+    addBusyPoll(seqraii, socketfd, 0);
+    addMemoryMap(seqraii, memory, 1 << 16, MAP_POPULATE);
+    addMemoryLock(seqraii, memory, 1 << 16);
+    addEventFd(seqraii, wakefd, EFD_NONBLOCK);
+    addEpoll(seqraii, epollfd);
+    addEpollWatch(seqraii, epollfd, wakefd, EPOLLIN);
+    addThreadAffinity(seqraii, affinity({cpu}), label("pin"));
+
+    InitResult result;
+    ASSERT_TRUE(seqraii.initialize(result)) << result.failedStep << ": " << result.error.message();
+
+    static_cast<char*>(memory)[0] = 1;
+
+    const std::uint64_t one = 1;
+    EXPECT_EQ(write(wakefd, &one, sizeof(one)), static_cast<ssize_t>(sizeof(one)));
+    epoll_event event = {};
+    EXPECT_EQ(epoll_wait(epollfd, &event, 1, 0), 1);
+    EXPECT_EQ(event.data.fd, wakefd);
+
+    cpu_set_t pinned;
+    sched_getaffinity(0, sizeof(pinned), &pinned);
+    EXPECT_EQ(CPU_COUNT(&pinned), 1);
+
+    seqraii.uninitialize();
+    EXPECT_EQ(socketfd, -1);
+    EXPECT_EQ(memory, nullptr);
+    EXPECT_EQ(wakefd, -1);
+    sched_getaffinity(0, sizeof(pinned), &pinned);
+    EXPECT_TRUE(CPU_EQUAL(&pinned, &allowed));
+
+    // Sizing a socket that isn't one reports what the kernel said.
+    int notSocket = -1;
+    SequentialRaii failing;
+    addSocketBuffers(failing, notSocket, 4096, 0, label("buffers"));
+    EXPECT_FALSE(failing.initialize(result));
+    EXPECT_STREQ(result.label, "buffers");
+    EXPECT_EQ(result.error, std::error_code(EBADF, std::system_category()));
+}
+
+/**
+ * Test that asking for socket buffers beyond the sysctl limit fails rather than leaving a smaller
+ * buffer, although the size the kernel reports is doubled.
+ */
+TEST(seqraii, test_socket_buffers_capped)
+{
+    int limit = 0;
+    std::FILE* file = std::fopen("/proc/sys/net/core/rmem_max", "r");
+    ASSERT_TRUE(file);
+    ASSERT_EQ(std::fscanf(file, "%d", &limit), 1);
+    std::fclose(file);
+
+    int socketfd = -1;
+    SequentialRaii seqraii;
+    addSocket(seqraii, socketfd, AF_INET, SOCK_DGRAM, 0);
+    ASSERT_TRUE(seqraii.initialize());
+
+    // Between the limit and twice the limit, which the doubled size read back would still cover.
+    const int bytes = limit + limit / 2;
+    if (setsockopt(socketfd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) == 0)
+    {
+        GTEST_SKIP() << "SO_RCVBUFFORCE ignores the limit for this process";
+    }
+
+    addSocketBuffers(seqraii, socketfd, bytes, 0, label("buffers"));
+    InitResult result;
+    EXPECT_FALSE(seqraii.initialize(result));
+    EXPECT_STREQ(result.label, "buffers");
+    EXPECT_EQ(result.error, std::make_error_code(std::errc::no_buffer_space));
+}
+
+/**
+ * Test that pinning the thread for good is kept with the sequence having an affinity of its own,
+ * which would otherwise restore the thread's CPUs right after the step.
+ */
+TEST(seqraii, test_thread_affinity_step_pins)
+{
+    cpu_set_t allowed;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    Affinity everywhere;
+    unsigned cpu = CPU_SETSIZE;
+    for (unsigned i = 0; i < CPU_SETSIZE && i < everywhere.cpus.size(); ++i)
+    {
+        if (CPU_ISSET(i, &allowed))
+        {
+            everywhere.cpus.set(i);
+            cpu = std::min(cpu, i);
+        }
+    }
+
+    SequentialRaii seqraii;
+    seqraii.setAffinity(everywhere);
+    addThreadAffinity(seqraii, affinity({cpu}), label("pin"));
+    ASSERT_TRUE(seqraii.initialize());
+
+    cpu_set_t pinned;
+    sched_getaffinity(0, sizeof(pinned), &pinned);
+    EXPECT_EQ(CPU_COUNT(&pinned), 1);
+    EXPECT_TRUE(CPU_ISSET(cpu, &pinned));
+
+    seqraii.uninitialize();
+    sched_getaffinity(0, sizeof(pinned), &pinned);
+    EXPECT_TRUE(CPU_EQUAL(&pinned, &allowed));
+}
+#endif
+
+/**
+ * Test that heal() keeps the steps before the first one failing its check, re-initializes the
+ * steps from it onwards, and resumes on a later call if re-initializing fails.
+ */
+TEST(seqraii, test_heal)
+{
+    std::vector<int> counter;
+    bool connected = true;
+    bool reconnects = true;
+    int cacheFills = 0;
+
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {++cacheFills; counter.push_back(0); return true;}, [&]() {counter.push_back(10);},
+                    verify([]() {return true;}));
+    seqraii.addStep([&]() {counter.push_back(1); return reconnects;}, [&]() {counter.push_back(11);},
+                    verify([&]() {return connected;}), label("connection"));
+    seqraii.addStep([&]() {counter.push_back(2); return true;}, [&]() {counter.push_back(12);});
+
+    EXPECT_TRUE(seqraii.initialize());
+    EXPECT_EQ(seqraii.checkHealth(), static_cast<std::size_t>(InitResult::kNoStep));
+    counter.clear();
+    EXPECT_TRUE(seqraii.heal());
+    EXPECT_TRUE(counter.empty());
+
+    connected = false;
+    EXPECT_EQ(seqraii.checkHealth(), 1u);
+    connected = true;
+    seqraii.addStep([]() {return true;});
+    EXPECT_EQ(seqraii.checkHealth(), 3u);
+    EXPECT_TRUE(seqraii.heal());
+
+    // The connection drops and can't be brought back at first.
+    connected = false;
+    reconnects = false;
+    counter.clear();
+    InitResult result;
+    EXPECT_FALSE(seqraii.heal(result));
+    EXPECT_EQ(counter, (std::vector<int>{12, 11, 1}));
+    EXPECT_EQ(result.failedStep, 1u);
+    EXPECT_STREQ(result.label, "connection");
+    EXPECT_EQ(seqraii.initializedSteps(), 1u);
+
+    connected = true;
+    reconnects = true;
+    counter.clear();
+    EXPECT_TRUE(seqraii.heal());
+    EXPECT_EQ(counter, (std::vector<int>{1, 2}));
+    EXPECT_EQ(seqraii.initializedSteps(), 4u);
+    EXPECT_EQ(cacheFills, 1);
+}
+
+/**
+ * Test a sequence larger than the inline step storage. Order must be kept across the inline
+ * buffer and allocated chunks, also after moving the container.
+ */
+TEST(seqraii, test_large_sequence_move)
+{
+    std::vector<int> counter;
+
+    SequentialRaii seqraii;
+    seqraii.reserve(50);
+
+    for (int i = 0; i < 100; ++i)
+    {
+        seqraii.addStep([&counter, i]() {counter.push_back(i); return true;},
+                        [&counter]() {counter.pop_back();});
+    }
+
+    SequentialRaii targetSeqraii(std::move(seqraii));
+    seqraii.uninitialize();
+
+    EXPECT_TRUE(targetSeqraii.initialize());
+    ASSERT_EQ(100, counter.size());
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(i, counter[i]);
+    }
+
+    targetSeqraii.uninitialize();
+    EXPECT_EQ(0, counter.size());
+}
+
+#if SEQRAII_HAS_MEMORY_RESOURCE
+/**
+ * Memory resource counting the allocations passed on to the default resource.
+ */
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    int allocations = 0;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+/**
+ * Test that step storage beyond the inline buffer is drawn from an injected memory resource,
+ * and that a reserved sequence is built with a constant number of allocations.
+ */
+TEST(seqraii, test_memory_resource)
+{
+    int counter = 0;
+    CountingResource resource;
+
+    {
+        SequentialRaii seqraii(&resource);
+        seqraii.reserve(200);
+
+        for (int i = 0; i < 200; ++i)
+        {
+            seqraii.addStep([&]() {++counter; return true;}, [&]() {--counter;});
+        }
+
+        EXPECT_TRUE(seqraii.initialize());
+        EXPECT_EQ(200, counter);
+
+        // One block for the step index, one for the steps.
+        EXPECT_EQ(2, resource.allocations);
+    }
+
+    EXPECT_EQ(0, counter);
+}
+#endif
+/**
+ * Test parallel initialization. Independent steps must be able to run at the same time, and a
+ * step must only start once all of its dependencies are initialized.
+ */
+TEST(seqraii, test_parallel_initialization)
+{
+    std::mutex mutex;
+    std::vector<int> order;
+    std::atomic<int> started{0};
+
+    auto record = [&](int value) {std::lock_guard<std::mutex> lock(mutex); order.push_back(value);};
+
+    // Both independent steps wait for each other, so they can only succeed when run concurrently.
+    auto rendezvous = [&]()
+    {
+        ++started;
+        const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (started < 2 && std::chrono::steady_clock::now() < timeout)
+        {
+            std::this_thread::yield();
+        }
+
+        return started >= 2;
+    };
+
+    SequentialRaii seqraii;
+    auto first = seqraii.addStep([&]() {record(0); return rendezvous();}, after());
+    auto second = seqraii.addStep([&]() {record(1); return rendezvous();}, after());
+    seqraii.addStep([&]() {record(2); return true;}, [](){}, after(first, second));
+    seqraii.addStep([&]() {record(3); return true;});
+
+    ThreadPool pool(2);
+    EXPECT_TRUE(seqraii.initialize(pool));
+
+    ASSERT_EQ(4, order.size());
+    EXPECT_EQ(2, order[2]);
+    EXPECT_EQ(3, order[3]);
+}
+
+/**
+ * Test failed parallel initialization. Only steps that completed must be uninitialized, and
+ * steps depending on the failed one must never run.
+ */
+TEST(seqraii, test_parallel_failed_initialization)
+{
+    std::atomic<int> initialized{0};
+    std::atomic<int> cleanups{0};
+    bool dependentRan = false;
+
+    SequentialRaii seqraii;
+    seqraii.addStep([&]() {++initialized; return true;}, [&]() {++cleanups;}, after());
+    auto failing = seqraii.addStep([&]() {throw std::runtime_error(""); return true;}, [&]() {++cleanups;}, after());
+    seqraii.addStep([&]() {dependentRan = true; return true;}, [&]() {++cleanups;}, after(failing));
+
+    ThreadPool pool(2);
+    InitResult result;
+    EXPECT_FALSE(seqraii.initialize(pool, nullptr, &result));
+    EXPECT_EQ(result.failedStep, failing.index);
+    EXPECT_TRUE(result.exception);
+    EXPECT_FALSE(dependentRan);
+    EXPECT_EQ(initialized.load(), cleanups.load());
+
+    seqraii.uninitialize();
+    EXPECT_EQ(initialized.load(), cleanups.load());
+}
+
+/**
+ * Test an executor failing to take a step. The step must be reported with its label, and the
+ * steps that completed rolled back.
+ */
+TEST(seqraii, test_parallel_executor_failure)
+{
+    struct FullExecutor : Executor
+    {
+        int capacity = 1;
+
+        void execute(std::function<void()> task) override
+        {
+            if (capacity-- <= 0)
+            {
+                throw std::runtime_error("queue full");
+            }
+
+            task();
+        }
+    };
+
+    int cleanups = 0;
+    SequentialRaii seqraii;
+    seqraii.addStep([]() {return true;}, [&]() {++cleanups;}, label("first"), after());
+    auto rejected = seqraii.addStep([]() {return true;}, label("second"), after());
+
+    FullExecutor executor;
+    InitResult result;
+    EXPECT_FALSE(seqraii.initialize(executor, nullptr, &result));
+    EXPECT_EQ(result.failedStep, rejected.index);
+    EXPECT_STREQ(result.label, "second");
+    EXPECT_EQ(result.error, std::make_error_code(std::errc::resource_unavailable_try_again));
+    EXPECT_EQ(cleanups, 1);
+}
+
+/**
+ * Test parallel uninitialization. Independent steps must be torn down concurrently, and a step
+ * must only be uninitialized after every step depending on it.
+ */
+TEST(seqraii, test_parallel_uninitialization)
+{
+    std::mutex mutex;
+    std::vector<int> order;
+    std::atomic<int> started{0};
+
+    auto record = [&](int value) {std::lock_guard<std::mutex> lock(mutex); order.push_back(value);};
+    auto rendezvous = [&]()
+    {
+        ++started;
+        const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (started < 2 && std::chrono::steady_clock::now() < timeout)
+        {
+            std::this_thread::yield();
+        }
+    };
+
+    SequentialRaii seqraii;
+    auto first = seqraii.addStep([]() {return true;}, [&]() {rendezvous(); record(0);}, after());
+    auto second = seqraii.addStep([]() {return true;}, [&]() {rendezvous(); record(1);}, after());
+    seqraii.addStep([]() {return true;}, [&]() {record(2);}, after(first, second));
+
+    ThreadPool pool(2);
+    ASSERT_TRUE(seqraii.initialize());
+    seqraii.uninitialize(pool);
+
+    ASSERT_EQ(3, order.size());
+    EXPECT_EQ(2, order[0]);
+    EXPECT_EQ(2, started.load());
+
+    // Nothing is left to uninitialize.
+    seqraii.uninitialize();
+    EXPECT_EQ(3, order.size());
+}
+
+/**
+ * Observer recording the hooks it receives as strings.
+ */
+struct RecordingObserver
+{
+    void onInitBegin(std::size_t index, const char* label) noexcept {record("init", index, label);}
+    void onInitEnd(std::size_t index, const char* label, bool success) noexcept {record(success ? "ok" : "nok", index, label);}
+    void onUninitBegin(std::size_t index, const char* label) noexcept {record("uninit", index, label);}
+    void onUninitEnd(std::size_t, const char*) noexcept {}
+    void onFailure(std::size_t index, const char* label) noexcept {record("fail", index, label);}
+
+    void record(const char* hook, std::size_t index, const char* label)
+    {
+        events.push_back(std::string(hook) + " " + std::to_string(index) + " " + (label ? label : "-"));
+    }
+
+    std::vector<std::string> events;
+};
+
+/**
+ * Test observer hooks. Every step must be reported with its index and label, including the
+ * failing step and the rollback of the steps before it.
+ */
+TEST(seqraii, test_observer)
+{
+    SequentialRaii seqraii;
+    seqraii.addStep([]() {return true;}, label("socket"));
+    seqraii.addStep([]() {return false;}, [](){}, label("bind"));
+
+    RecordingObserver observer;
+    EXPECT_FALSE(seqraii.initialize(observer));
+
+    const std::vector<std::string> expected = {
+        "init 0 socket", "ok 0 socket", "init 1 bind", "nok 1 bind", "fail 1 bind",
+        "uninit 0 socket"};
+    EXPECT_EQ(expected, observer.events);
+}
+
+/**
+ * Test the built-in step timer, also when used from a parallel run.
+ */
+TEST(seqraii, test_step_timer)
+{
+    SequentialRaii seqraii;
+    seqraii.addStep([]() {std::this_thread::sleep_for(std::chrono::milliseconds(2)); return true;}, label("slow"), after());
+    seqraii.addStep([]() {return true;}, after());
+
+    StepTimer timer;
+    ThreadPool pool(2);
+    EXPECT_TRUE(seqraii.initialize(pool, &timer));
+
+    ASSERT_EQ(2, timer.timings().size());
+    EXPECT_STREQ("slow", timer.timings()[0].label);
+    EXPECT_GE(timer.timings()[0].initDuration, std::chrono::milliseconds(2));
+    EXPECT_TRUE(timer.timings()[1].initialized);
+
+    seqraii.uninitialize(timer);
+    EXPECT_FALSE(timer.timings()[0].initialized);
+    EXPECT_FALSE(timer.timings()[0].failed);
+}
+
+/**
+ * Test the trace and summary reports, and that the critical path follows the slowest chain of
+ * dependencies.
+ */
+TEST(seqraii, test_step_report)
+{
+    auto sleepFor = [](int ms) {return [ms]() {std::this_thread::sleep_for(std::chrono::milliseconds(ms)); return true;};};
+    SequentialRaii seqraii;
+    auto root = seqraii.addStep(sleepFor(1), label("root"), after());
+    auto slow = seqraii.addStep(sleepFor(20), label("slow \"quoted\""), after(root));
+    auto fast = seqraii.addStep(sleepFor(1), label("fast"), after(root));
+    seqraii.addStep(sleepFor(1), label("join"), after(slow, fast));
+
+    EXPECT_EQ(seqraii.dependencies(3), (std::vector<std::size_t>{1, 2}));
+    EXPECT_TRUE(seqraii.dependencies(0).empty());
+
+    StepTimer timer;
+    ThreadPool pool(2);
+    EXPECT_TRUE(seqraii.initialize(pool, &timer));
+    seqraii.uninitialize(timer);
+    EXPECT_EQ(criticalPath(timer, seqraii), (std::vector<std::size_t>{0, 1, 3}));
+
+    std::ostringstream trace;
+    writeChromeTrace(trace, timer);
+    EXPECT_NE(trace.str().find("\"traceEvents\""), std::string::npos);
+    EXPECT_NE(trace.str().find("\"name\":\"slow \\\"quoted\\\"\""), std::string::npos);
+    EXPECT_NE(trace.str().find("\"cat\":\"uninit\""), std::string::npos);
+    EXPECT_NE(trace.str().find("\"ts\":0.000,"), std::string::npos);
+    EXPECT_EQ(trace.precision(), std::ostringstream().precision());
+
+    // The slowest step ranks first and is on the critical path.
+    std::ostringstream summary;
+    writeSummary(summary, timer, seqraii);
+    std::string text = summary.str();
+    const std::size_t firstRow = text.find('\n') + 1;
+    EXPECT_EQ(text.compare(firstRow, 1, "*"), 0);
+    EXPECT_LT(text.find("slow"), text.find("fast"));
+    EXPECT_NE(text.find("critical path"), std::string::npos);
+}
+
+/**
+ * Test that the items of a range run in chunks on an executor are all initialized and
+ * uninitialized, and that a failing item stops the chunks and rolls back every completed item.
+ */
+TEST(seqraii, test_range_steps_chunks)
+{
+    const std::size_t count = 1000;
+    std::vector<std::atomic<int>> items(count);
+    std::atomic<int> live{0};
+    ThreadPool pool(4);
+    auto build = [&](SequentialRaii& seqraii, std::size_t failing)
+    {
+        seqraii.addSteps(count,
+            [&, failing](std::size_t i)
+            {
+                if (i == failing)
+                {
+                    return false;
+                }
+
+                ++items[i];
+                ++live;
+                return true;
+            },
+            [&](std::size_t i) {--items[i]; --live;},
+            inChunks(pool, 64));
+    };
+
+    {
+        SequentialRaii seqraii;
+        build(seqraii, count);
+        EXPECT_TRUE(seqraii.initialize());
+        EXPECT_EQ(live.load(), static_cast<int>(count));
+        for (const auto& item : items)
+        {
+            EXPECT_EQ(item.load(), 1);
+        }
+
+        seqraii.uninitialize();
+        EXPECT_EQ(live.load(), 0);
+    }
+
+    SequentialRaii failing;
+    build(failing, 500);
+    InitResult result;
+    EXPECT_FALSE(failing.initialize(result));
+    EXPECT_EQ(result.failedItem, 500u);
+    EXPECT_EQ(live.load(), 0);
+    for (const auto& item : items)
+    {
+        EXPECT_EQ(item.load(), 0);
+    }
+}
+
+#if defined(__cpp_impl_coroutine)
+/**
+ * Minimal single threaded event loop. Awaiting a Resume suspends the coroutine until the loop
+ * gets around to it.
+ */
+struct EventLoop
+{
+    struct Resume
+    {
+        EventLoop& loop;
+
+        bool await_ready() noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> handle) {loop.queue.push_back(handle);}
+        void await_resume() noexcept {}
+    };
+
+    Resume next()
+    {
+        return Resume{*this};
+    }
+
+    void run()
+    {
+        while (!queue.empty())
+        {
+            auto handle = queue.front();
+            queue.pop_front();
+            handle.resume();
+        }
+    }
+
+    std::deque<std::coroutine_handle<>> queue;
+};
+
+/**
+ * Test asynchronous initialization. Several sequences are driven by a single thread, their
+ * asynchronous steps interleaving while keeping the order within each sequence.
+ */
+TEST(seqraii, test_async_initialization)
+{
+    EventLoop loop;
+    std::vector<int> order;
+
+    auto asyncStep = [&](int value) -> Task<bool>
+    {
+        co_await loop.next();
+        order.push_back(value);
+        co_return true;
+    };
+
+    SequentialRaii first;
+    first.addAsyncStep([&]() {return asyncStep(0);});
+    first.addStep([&]() {order.push_back(2); return true;});
+
+    SequentialRaii second;
+    second.addAsyncStep([&]() {return asyncStep(1);});
+
+    auto firstTask = first.initializeAsync();
+    auto secondTask = second.initializeAsync();
+    firstTask.start();
+    secondTask.start();
+    EXPECT_TRUE(order.empty());
+
+    loop.run();
+    ASSERT_TRUE(firstTask.done());
+    ASSERT_TRUE(secondTask.done());
+    EXPECT_TRUE(firstTask.result());
+    EXPECT_TRUE(secondTask.result());
+
+    // The first sequence continues with its regular step before the loop resumes the second.
+    EXPECT_EQ((std::vector<int>{0, 2, 1}), order);
+}
+
+/**
+ * Test failed asynchronous initialization. Completed steps must be rolled back as usual.
+ */
+TEST(seqraii, test_async_failed_initialization)
+{
+    EventLoop loop;
+    bool didCleanup = false;
+
+    SequentialRaii seqraii;
+    seqraii.addAsyncStep([&]() -> Task<bool> {co_await loop.next(); co_return true;}, [&]() {didCleanup = true;});
+    seqraii.addAsyncStep([&]() -> Task<bool> {co_await loop.next(); throw std::runtime_error("");});
+
+    auto task = seqraii.initializeAsync();
+    task.start();
+    loop.run();
+
+    ASSERT_TRUE(task.done());
+    EXPECT_FALSE(task.result());
+    EXPECT_TRUE(didCleanup);
+}
+
+/**
+ * Test the failure details and observer calls of asynchronous initialization. They must match
+ * those of initialize(), also for the error code an asynchronous step yields.
+ */
+TEST(seqraii, test_async_failure_details)
+{
+    EventLoop loop;
+
+    SequentialRaii seqraii;
+    seqraii.addStep([]() {return true;}, label("socket"));
+    seqraii.addAsyncStep([&]() -> Task<std::error_code>
+        {
+            co_await loop.next();
+            co_return std::make_error_code(std::errc::connection_refused);
+        }, label("connect"));
+
+    StepTimer timer;
+    InitResult result;
+    auto task = seqraii.initializeAsync(timer, result);
+    task.start();
+    loop.run();
+
+    ASSERT_TRUE(task.done());
+    EXPECT_FALSE(task.result());
+    EXPECT_EQ(1u, result.failedStep);
+    EXPECT_STREQ("connect", result.label);
+    EXPECT_EQ(std::make_error_code(std::errc::connection_refused), result.error);
+    ASSERT_EQ(2u, timer.timings().size());
+    EXPECT_TRUE(timer.timings()[1].failed);
+    EXPECT_NE(timer.timings()[0].uninitThread, std::thread::id());
+
+    // A throwing step reports its exception.
+    SequentialRaii throwing;
+    throwing.addAsyncStep([&]() -> Task<bool> {co_await loop.next(); throw std::runtime_error("down");});
+    auto throwingTask = throwing.initializeAsync(result);
+    throwingTask.start();
+    loop.run();
+
+    EXPECT_FALSE(throwingTask.result());
+    EXPECT_EQ(0u, result.failedStep);
+    EXPECT_TRUE(result.exception);
+
+    // A plain false reports no error, whatever errno became while the step was suspended.
+    SequentialRaii failing;
+    failing.addAsyncStep([&]() -> Task<bool> {co_await loop.next(); errno = EBADF; co_return false;});
+    auto failingTask = failing.initializeAsync(result);
+    failingTask.start();
+    loop.run();
+
+    EXPECT_FALSE(failingTask.result());
+    EXPECT_EQ(0u, result.failedStep);
+    EXPECT_FALSE(result.error);
+}
+#endif
 
 int main(int argc, char **argv)
 {